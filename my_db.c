@@ -1,3 +1,7 @@
+#ifdef __linux__
+// copy_file_range
+#define _GNU_SOURCE
+#endif
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -5,6 +9,7 @@
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 #include "my_db.h"
 
 
@@ -21,12 +26,30 @@ void print_prompt() {
 }
 
 void print_constants() {
-    printf("ROW_SIZE: %d\n", ROW_SIZE);
+//    printf("ROW_SIZE: %d\n", ROW_SIZE);
     printf("COMMON_NODE_HEADER_SIZE: %d\n", COMMON_NODE_HEADER_SIZE);
     printf("LEAF_NODE_HEADER_SIZE: %d\n", LEAF_NODE_HEADER_SIZE);
-    printf("LEAF_NODE_CELL_SIZE: %d\n", LEAF_NODE_CELL_SIZE);
+//    printf("LEAF_NODE_CELL_SIZE: %d\n", LEAF_NODE_CELL_SIZE);
     printf("LEAF_NODE_SPACE_FOR_CELLS: %d\n", LEAF_NODE_SPACE_FOR_CELLS);
-    printf("LEAF_NODE_MAX_CELLS: %d\n", LEAF_NODE_MAX_CELLS);
+//    printf("LEAF_NODE_MAX_CELLS: %d\n", LEAF_NODE_MAX_CELLS);
+    printf("CATALOG_RECORD_SIZE: %d\n", CATALOG_RECORD_SIZE);
+}
+
+void print_schema(Table *table) {
+    Schema *schema = &(table->schema);
+    printf("%s (", table->name);
+    for (uint32_t i = 0; i < schema->num_columns; i++) {
+        Column *column = &(schema->columns[i]);
+        if (column->type == COLUMN_INT) {
+            printf("%s int", column->name);
+        } else {
+            printf("%s text(%d)", column->name, column->size);
+        }
+        if (i + 1 < schema->num_columns) {
+            printf(", ");
+        }
+    }
+    printf(")%s row_size %d\n", table->access_method == ACCESS_METHOD_HASH ? " using hash" : "", schema->row_size);
 }
 
 void print_leaf_node(void *node) {
@@ -38,14 +61,82 @@ void print_leaf_node(void *node) {
     }
 }
 
-MetaCommandResult do_meta_command(InputBuffer *input_buffer, Table *table) {
+void print_hash_index(Pager *pager, void *directory) {
+    uint32_t global_depth = *hash_directory_global_depth(directory);
+    printf("hash (global depth %d)\n", global_depth);
+    for (uint32_t i = 0; i < (1u << global_depth); i++) {
+        void *bucket = get_page(pager, *hash_directory_entry(directory, i));
+        uint32_t local_depth = *hash_bucket_local_depth(bucket);
+        // 一个bucket被多个下标指向，只在最小的下标处打印
+        if (i >= (1u << local_depth)) {
+            continue;
+        }
+        printf("- bucket %d (local depth %d) ", i, local_depth);
+        print_leaf_node(bucket);
+    }
+}
+
+MetaCommandResult do_meta_command(InputBuffer *input_buffer, Database *db) {
     if (strcmp(input_buffer->buffer, ".exit") == 0) {
         close_input_buffer(input_buffer);
-        db_close(table);
+        db_close(db);
         exit(EXIT_SUCCESS);
     } else if (strcmp(input_buffer->buffer, ".btree") == 0) {
         printf("Tree:\n");
-        print_leaf_node(get_page(table->pager, 0));
+        for (uint32_t i = 0; i < db->num_tables; i++) {
+            Table *table = db->tables[i];
+            printf("%s ", table->name);
+            if (table->access_method == ACCESS_METHOD_HASH) {
+                print_hash_index(db->pager, get_page(db->pager, table->root_page_num));
+            } else {
+                print_leaf_node(get_page(db->pager, table->root_page_num));
+            }
+        }
+        return META_COMMAND_SUCCESS;
+    } else if (strcmp(input_buffer->buffer, ".vacuum") == 0) {
+        // 失败时旧文件和缓存里的页都不受影响，会话继续
+        if (db_vacuum(db)) {
+            printf("Vacuumed.\n");
+        } else {
+            printf("Vacuum failed.\n");
+        }
+        return META_COMMAND_SUCCESS;
+    } else if (strncmp(input_buffer->buffer, ".backup", 7) == 0
+               && (input_buffer->buffer[7] == ' ' || input_buffer->buffer[7] == '\0')) {
+        // 比如：.backup /tmp/backup.db
+        char *file_name = input_buffer->buffer + 7;
+        while (*file_name == ' ') {
+            file_name++;
+        }
+        if (*file_name == '\0') {
+            printf("Must supply a backup filename.\n");
+            return META_COMMAND_SUCCESS;
+        }
+        // 备份失败不退出，当前会话和缓存里的页都不受影响
+        Backup *backup = backup_init(db, file_name);
+        if (backup == NULL) {
+            printf("Backup failed.\n");
+            return META_COMMAND_SUCCESS;
+        }
+        BackupResult result;
+        do {
+            result = backup_step(backup, BACKUP_STEP_PAGES);
+            if (result == BACKUP_ERROR) {
+                backup_abort(backup);
+            } else if (result == BACKUP_DONE) {
+                result = backup_finish(backup);
+            }
+        } while (result == BACKUP_MORE);
+        if (result == BACKUP_DONE) {
+            printf("Backed up.\n");
+        } else {
+            printf("Backup failed.\n");
+        }
+        return META_COMMAND_SUCCESS;
+    } else if (strcmp(input_buffer->buffer, ".tables") == 0) {
+        for (uint32_t i = 0; i < db->num_tables; i++) {
+            print_schema(db->tables[i]);
+        }
         return META_COMMAND_SUCCESS;
     } else if (strcmp(input_buffer->buffer, ".constants") == 0) {
         printf("Constants:\n");
@@ -56,19 +147,84 @@ MetaCommandResult do_meta_command(InputBuffer *input_buffer, Table *table) {
     }
 }
 
-Table *db_open(const char *file_name) {
-    Pager *pager = pager_open(file_name);
+Database *db_open(const char *file_name, bool compress) {
+    Pager *pager = pager_open(file_name, compress);
+    if (pager == NULL) {
+        printf("Unable to open file\n");
+        exit(EXIT_FAILURE);
+    }
 //    uint32_t num_rows = pager->file_length / ROW_SIZE;
 
-    Table *table = malloc(sizeof(Table));
-    table->pager = pager;
-//    table->num_rows = num_rows;
-    table->root_page_num = 0;
+    Database *db = malloc(sizeof(Database));
+    db->pager = pager;
+    db->file_name = strdup(file_name);
+    db->generation = 0;
+    db->num_tables = 0;
+    db->tables = malloc(DATABASE_MAX_TABLES * sizeof(Table *));
+
+    // catalog的value是固定格式的catalog record，不走用户表的schema
+    Table *catalog = malloc(sizeof(Table));
+    catalog->pager = pager;
+    catalog->root_page_num = CATALOG_ROOT_PAGE_NUM;
+    catalog->table_id = 0;
+    strcpy(catalog->name, "catalog");
+    catalog->schema.num_columns = 0;
+    catalog->schema.row_size = CATALOG_RECORD_SIZE;
+    catalog->access_method = ACCESS_METHOD_BTREE;
+    db->catalog = catalog;
+
+    // 普通格式的文件总是整页写入，长度不是PAGE_SIZE的整数倍说明不是数据库文件或者已经损坏
+    if (!pager->compressed && pager->file_length % PAGE_SIZE != 0) {
+        printf("Not a database file or unsupported format.\n");
+        exit(EXIT_FAILURE);
+    }
+    bool new_database = (pager->num_pages == 0);
+    if (new_database) {
+        // New database file. Initialize page 0 as catalog leaf node.
+        void *root_node = get_page(pager, CATALOG_ROOT_PAGE_NUM);
+        initialize_catalog_node(root_node);
+        pager_mark_dirty(pager, CATALOG_ROOT_PAGE_NUM);
+    } else if (!catalog_node_valid(get_page(pager, CATALOG_ROOT_PAGE_NUM))) {
+        // 旧格式（page 0是users表）或者其他文件，直接退出，不写入任何东西
+        printf("Not a database file or unsupported format.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // 加载catalog，每张表的列偏移量只在open时计算一次
+    // 文件里读出的内容都要先检查，再写进db->tables和schema
+    Cursor *cursor = table_start(catalog);
+    while (!cursor->end_of_table) {
+        Table *table = malloc(sizeof(Table));
+        if (!deserialize_catalog_record(cursor_value(cursor), table)
+            || table->root_page_num == CATALOG_ROOT_PAGE_NUM || table->root_page_num >= pager->num_pages
+            || !schema_compute_layout(&(table->schema))) {
+            printf("Corrupt catalog record in database file.\n");
+            exit(EXIT_FAILURE);
+        }
+        table->pager = pager;
+        db->tables[db->num_tables] = table;
+        db->num_tables += 1;
+        cursor_advance(cursor);
+    }
+    free(cursor);
 
-    if (pager->num_pages == 0) {
-        // New database file. Initialize page 0 as leaf node.
-        void *root_node = get_page(pager, 0);
-        initialize_leaf_node(root_node);
+    if (new_database) {
+        // 创建默认表users
+        Statement statement;
+        strcpy(statement.table_name, DEFAULT_TABLE_NAME);
+        Schema *schema = &(statement.schema);
+        schema->num_columns = 3;
+        strcpy(schema->columns[0].name, "id");
+        schema->columns[0].type = COLUMN_INT;
+        schema->columns[0].size = sizeof(uint32_t);
+        strcpy(schema->columns[1].name, "username");
+        schema->columns[1].type = COLUMN_TEXT;
+        schema->columns[1].size = COLUMN_USERNAME_SIZE;
+        strcpy(schema->columns[2].name, "email");
+        schema->columns[2].type = COLUMN_TEXT;
+        schema->columns[2].size = COLUMN_EMAIL_SIZE;
+        statement.access_method = ACCESS_METHOD_BTREE;
+        execute_create_table(&statement, db);
     }
 
 //    Table *table = (Table *) malloc(sizeof(Table));
@@ -76,18 +232,396 @@ Table *db_open(const char *file_name) {
 //    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
 //        table->pages[i] = NULL;
 //    }
-    return table;
+    return db;
+}
+
+bool db_vacuum(Database *db) {
+    // 重建到一个新文件：page 0是catalog，之后每张表按catalog顺序依次写入，cell已按key有序
+    // 重建期间只读旧Pager，旧文件一直可用，最后rename原子替换
+    // rename之前出错时删除临时文件、保留旧Pager，返回false
+    size_t name_length = strlen(db->file_name);
+    char *vacuum_file_name = malloc(name_length + sizeof(VACUUM_FILE_SUFFIX));
+    strcpy(vacuum_file_name, db->file_name);
+    strcpy(vacuum_file_name + name_length, VACUUM_FILE_SUFFIX);
+
+    // 清理上次中断留下的文件
+    unlink(vacuum_file_name);
+    Pager *pager = pager_open(vacuum_file_name, db->pager->compressed);
+    if (pager == NULL) {
+        printf("Unable to open vacuum file: %d\n", errno);
+        free(vacuum_file_name);
+        return false;
+    }
+
+    Table catalog = *(db->catalog);
+    catalog.pager = pager;
+    void *catalog_node = get_page(pager, catalog.root_page_num);
+    memset(catalog_node, 0, PAGE_SIZE);
+    initialize_catalog_node(catalog_node);
+    pager_mark_dirty(pager, catalog.root_page_num);
+
+    uint32_t *root_page_nums = malloc(db->num_tables * sizeof(uint32_t));
+    for (uint32_t i = 0; i < db->num_tables; i++) {
+        Table table = *(db->tables[i]);
+        void *old_node = get_page(db->pager, table.root_page_num);
+
+        table.pager = pager;
+        table.root_page_num = get_unused_page_num(pager);
+        void *node = get_page(pager, table.root_page_num);
+        // 新页先清零，旧页里已删除或未使用的字节不会带到新文件
+        memset(node, 0, PAGE_SIZE);
+        if (table.access_method == ACCESS_METHOD_HASH) {
+            // directory之后按directory顺序依次写每个bucket
+            initialize_hash_directory(node);
+            uint32_t global_depth = *hash_directory_global_depth(old_node);
+            *hash_directory_global_depth(node) = global_depth;
+            for (uint32_t j = 0; j < (1u << global_depth); j++) {
+                void *old_bucket = get_page(db->pager, *hash_directory_entry(old_node, j));
+                uint32_t local_depth = *hash_bucket_local_depth(old_bucket);
+                if (j >= (1u << local_depth)) {
+                    // 和更小的下标指向同一个bucket，那个bucket已经复制过了
+                    *hash_directory_entry(node, j) = *hash_directory_entry(node, j & ((1u << local_depth) - 1));
+                    continue;
+                }
+                uint32_t bucket_page_num = get_unused_page_num(pager);
+                void *bucket = get_page(pager, bucket_page_num);
+                memset(bucket, 0, PAGE_SIZE);
+                initialize_hash_bucket(bucket, *leaf_node_cell_size(old_bucket), local_depth);
+                vacuum_copy_cells(old_bucket, bucket);
+                pager_mark_dirty(pager, bucket_page_num);
+                *hash_directory_entry(node, j) = bucket_page_num;
+            }
+        } else {
+            initialize_leaf_node(node, *leaf_node_cell_size(old_node));
+            vacuum_copy_cells(old_node, node);
+        }
+        pager_mark_dirty(pager, table.root_page_num);
+        root_page_nums[i] = table.root_page_num;
+
+        Row record;
+        serialize_catalog_record(&table, record.data);
+        Cursor *cursor = table_find(&catalog, table.table_id);
+        leaf_node_insert(cursor, table.table_id, &record);
+        free(cursor);
+    }
+
+    // 新文件落盘后再替换，rename保证替换是原子的
+    pager_flush_all(pager);
+    bool renamed = false;
+    if (fsync(pager->file_descriptor) == -1) {
+        printf("Error syncing vacuum file: %d\n", errno);
+    } else if (rename(vacuum_file_name, db->file_name) == -1) {
+        printf("Error renaming vacuum file: %d\n", errno);
+    } else {
+        renamed = true;
+    }
+    if (!renamed) {
+        pager_close(pager, false);
+        unlink(vacuum_file_name);
+        free(vacuum_file_name);
+        free(root_page_nums);
+        return false;
+    }
+    free(vacuum_file_name);
+
+    // 旧文件已被替换，缓存的旧页直接丢弃
+    // 新Pager的fd在rename后指向的就是db->file_name，直接切换过去，不用重新打开
+    pager_close(db->pager, false);
+    db->pager = pager;
+    db->generation += 1;
+    db->catalog->pager = db->pager;
+    for (uint32_t i = 0; i < db->num_tables; i++) {
+        db->tables[i]->pager = db->pager;
+        db->tables[i]->root_page_num = root_page_nums[i];
+    }
+    free(root_page_nums);
+
+    // rename本身要等目录落盘才是持久的；这时已经切换到新文件，只报告失败
+    return file_sync_directory(db->file_name);
+}
+
+void vacuum_copy_cells(void *source, void *destination) {
+    uint32_t num_cells = *leaf_node_num_cells(source);
+    memcpy(leaf_node_cell(destination, 0), leaf_node_cell(source, 0), num_cells * *leaf_node_cell_size(source));
+    *leaf_node_num_cells(destination) = num_cells;
 }
 
-Pager *pager_open(const char *file_name) {
+Backup *backup_init(Database *db, const char *file_name) {
+    // 先写到"<file_name>-backup"，完成后rename，中途失败不会留下不完整的备份
+    // 出错时返回NULL
+    Backup *backup = malloc(sizeof(Backup));
+    backup->db = db;
+    backup->file_name = strdup(file_name);
+    size_t name_length = strlen(file_name);
+    backup->backup_file_name = malloc(name_length + sizeof(BACKUP_FILE_SUFFIX));
+    strcpy(backup->backup_file_name, file_name);
+    strcpy(backup->backup_file_name + name_length, BACKUP_FILE_SUFFIX);
+    backup->source = NULL;
+    backup->pager = NULL;
+    // 目标或临时文件是当前数据库文件时拒绝：rename会把正在使用的文件替换掉，或者unlink把它删掉
+    // 用st_dev/st_ino比较，路径写法不同（相对路径、软链接）也能识别
+    struct stat db_stat;
+    if (fstat(db->pager->file_descriptor, &db_stat) == -1
+        || file_is_same(backup->file_name, &db_stat) || file_is_same(backup->backup_file_name, &db_stat)) {
+        printf("Backup target must not be the database file.\n");
+        backup_abort(backup);
+        return NULL;
+    }
+    if (!backup_restart(backup)) {
+        backup_abort(backup);
+        return NULL;
+    }
+    return backup;
+}
+
+bool file_sync_directory(const char *file_name) {
+    // fsync文件所在的目录，让rename、创建文件这类目录项的修改落盘
+    const char *slash = strrchr(file_name, '/');
+    char *directory_name = slash == NULL ? strdup(".") : strndup(file_name, slash == file_name ? 1 : slash - file_name);
+    int fd = open(directory_name, O_RDONLY);
+    free(directory_name);
+    if (fd == -1 || fsync(fd) == -1) {
+        printf("Error syncing directory: %d\n", errno);
+        if (fd != -1) {
+            close(fd);
+        }
+        return false;
+    }
+    close(fd);
+    return true;
+}
+
+bool file_is_same(const char *file_name, struct stat *file_stat) {
+    struct stat other;
+    if (stat(file_name, &other) == -1) {
+        return false;
+    }
+    return other.st_dev == file_stat->st_dev && other.st_ino == file_stat->st_ino;
+}
+
+bool backup_restart(Backup *backup) {
+    if (backup->pager != NULL) {
+        pager_close(backup->pager, false);
+        backup->pager = NULL;
+    }
+    unlink(backup->backup_file_name);
+    backup->source = backup->db->pager;
+    backup->generation = backup->db->generation;
+    backup->pager = pager_open(backup->backup_file_name, backup->source->compressed);
+    if (backup->pager == NULL) {
+        printf("Unable to open backup file: %d\n", errno);
+        return false;
+    }
+    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
+        backup->copied[i] = false;
+        backup->copied_changes[i] = 0;
+    }
+    return true;
+}
+
+void backup_abort(Backup *backup) {
+    // 放弃备份：删除写了一半的临时文件，目标文件不变
+    if (backup->pager != NULL) {
+        pager_close(backup->pager, false);
+        unlink(backup->backup_file_name);
+    }
+    free(backup->backup_file_name);
+    free(backup->file_name);
+    free(backup);
+}
+
+bool backup_page_pending(Backup *backup, uint32_t page_num) {
+    // 还没复制过，或者复制之后又被修改过
+    Pager *source = backup->source;
+    return !backup->copied[page_num] || backup->copied_changes[page_num] != source->page_changes[page_num];
+}
+
+BackupResult backup_step(Backup *backup, uint32_t num_pages) {
+    // 每次最多复制num_pages页，两次step之间可以继续写；全部页都是最新的时返回BACKUP_DONE
+    if (backup->db->generation != backup->generation) {
+        // .vacuum换了文件，页号都变了，从头开始
+        if (!backup_restart(backup)) {
+            return BACKUP_ERROR;
+        }
+    }
+    Pager *source = backup->source;
+
+    uint32_t num_copied = 0;
+    uint32_t page_num = 0;
+    while (num_copied < num_pages) {
+        while (page_num < source->num_pages && !backup_page_pending(backup, page_num)) {
+            page_num++;
+        }
+        if (page_num >= source->num_pages) {
+            break;
+        }
+
+        // 连续的、和文件内容一致的页合成一次大的顺序复制
+        uint32_t count = 1;
+        if (!source->compressed && backup_page_on_disk(source, page_num)) {
+            while (num_copied + count < num_pages && page_num + count < source->num_pages
+                   && backup_page_pending(backup, page_num + count) && backup_page_on_disk(source, page_num + count)) {
+                count++;
+            }
+        }
+        if (!backup_copy_pages(backup, page_num, count)) {
+            return BACKUP_ERROR;
+        }
+        num_copied += count;
+        page_num += count;
+    }
+
+    for (uint32_t i = 0; i < source->num_pages; i++) {
+        if (backup_page_pending(backup, i)) {
+            return BACKUP_MORE;
+        }
+    }
+    return BACKUP_DONE;
+}
+
+bool backup_page_on_disk(Pager *pager, uint32_t page_num) {
+    // 没有未写回的修改，文件里的内容就是最新的
+    if (pager->pages[page_num] != NULL && pager->dirty[page_num]) {
+        return false;
+    }
+    if (pager->compressed) {
+        return pager->page_lengths[page_num] > 0;
+    }
+    return (page_num + 1) * PAGE_SIZE <= pager->file_length;
+}
+
+bool backup_copy_pages(Backup *backup, uint32_t page_num, uint32_t count) {
+    Pager *source = backup->source;
+    Pager *destination = backup->pager;
+
+    if (!backup_page_on_disk(source, page_num)) {
+        // 从cache复制，走目标Pager的flush（压缩格式下会在这里压缩）
+        void *page = get_page(destination, page_num);
+        memcpy(page, get_page(source, page_num), PAGE_SIZE);
+        pager_mark_dirty(destination, page_num);
+        pager_flush(destination, page_num);
+        free(destination->pages[page_num]);
+        destination->pages[page_num] = NULL;
+    } else if (source->compressed) {
+        // 直接复制压缩后的字节，不需要解压再压缩
+        uint32_t length = source->page_lengths[page_num];
+        if (length > destination->page_capacities[page_num]) {
+            destination->page_offsets[page_num] = destination->file_length;
+            destination->page_capacities[page_num] = source->page_capacities[page_num];
+            destination->file_length += source->page_capacities[page_num];
+        }
+        destination->page_lengths[page_num] = length;
+        if (!file_copy_range(source->file_descriptor, source->page_offsets[page_num],
+                             destination->file_descriptor, destination->page_offsets[page_num], length)) {
+            return false;
+        }
+    } else {
+        if (!file_copy_range(source->file_descriptor, page_num * PAGE_SIZE,
+                             destination->file_descriptor, page_num * PAGE_SIZE, count * PAGE_SIZE)) {
+            return false;
+        }
+    }
+
+    if (page_num + count > destination->num_pages) {
+        destination->num_pages = page_num + count;
+    }
+    for (uint32_t i = page_num; i < page_num + count; i++) {
+        backup->copied[i] = true;
+        backup->copied_changes[i] = source->page_changes[i];
+    }
+    return true;
+}
+
+bool file_copy_range(int source_fd, off_t source_offset, int destination_fd, off_t destination_offset, size_t length) {
+#ifdef __linux__
+    // 优先在内核里直接复制，不经过用户态buffer
+    while (length > 0) {
+        ssize_t bytes_copied = copy_file_range(source_fd, &source_offset, destination_fd, &destination_offset, length, 0);
+        if (bytes_copied <= 0) {
+            // 不支持或者跨文件系统，用下面的read/write
+            break;
+        }
+        length -= bytes_copied;
+    }
+#endif
+    void *buffer = malloc(BACKUP_STEP_PAGES * PAGE_SIZE);
+    while (length > 0) {
+        size_t chunk = length < BACKUP_STEP_PAGES * PAGE_SIZE ? length : BACKUP_STEP_PAGES * PAGE_SIZE;
+        ssize_t bytes_read = pread(source_fd, buffer, chunk, source_offset);
+        if (bytes_read <= 0) {
+            printf("Error reading file: %d\n", errno);
+            free(buffer);
+            return false;
+        }
+        ssize_t bytes_written = pwrite(destination_fd, buffer, bytes_read, destination_offset);
+        if (bytes_written != bytes_read) {
+            printf("Error writing: %d\n", errno);
+            free(buffer);
+            return false;
+        }
+        source_offset += bytes_read;
+        destination_offset += bytes_read;
+        length -= bytes_read;
+    }
+    free(buffer);
+    return true;
+}
+
+BackupResult backup_finish(Backup *backup) {
+    // 还有页没复制或者复制后又被修改时返回BACKUP_MORE，什么都不做，调用方继续step
+    // 失败时删除临时文件并释放backup，返回BACKUP_ERROR；成功时也释放backup
+    if (backup->db->generation != backup->generation) {
+        return BACKUP_MORE;
+    }
+    for (uint32_t i = 0; i < backup->source->num_pages; i++) {
+        if (backup_page_pending(backup, i)) {
+            return BACKUP_MORE;
+        }
+    }
+
+    Pager *pager = backup->pager;
+    if (pager->compressed) {
+        pager_write_header(pager);
+    }
+    if (fsync(pager->file_descriptor) == -1) {
+        printf("Error syncing backup file: %d\n", errno);
+        backup_abort(backup);
+        return BACKUP_ERROR;
+    }
+    pager_close(pager, false);
+    backup->pager = NULL;
+    if (rename(backup->backup_file_name, backup->file_name) == -1) {
+        printf("Error renaming backup file: %d\n", errno);
+        unlink(backup->backup_file_name);
+        backup_abort(backup);
+        return BACKUP_ERROR;
+    }
+    // 目录落盘之后rename才是持久的
+    bool synced = file_sync_directory(backup->file_name);
+    free(backup->backup_file_name);
+    free(backup->file_name);
+    free(backup);
+    return synced ? BACKUP_DONE : BACKUP_ERROR;
+}
+
+Table *db_find_table(Database *db, const char *name) {
+    for (uint32_t i = 0; i < db->num_tables; i++) {
+        if (strcmp(db->tables[i]->name, name) == 0) {
+            return db->tables[i];
+        }
+    }
+    return NULL;
+}
+
+Pager *pager_open(const char *file_name, bool compress) {
     int fd = open(file_name,
                   O_RDWR |  // Read/Write mode
                   O_CREAT,  // Create file if it does not exist
                   S_IWUSR | // User write permission
                   S_IRUSR); // User read permission
+    // 打不开时返回NULL，由调用方决定是否退出
     if (fd == -1) {
-        printf("Unable to open file\n");
-        exit(EXIT_FAILURE);
+        return NULL;
     }
     off_t file_length = lseek(fd, 0, SEEK_END);
 
@@ -95,14 +629,108 @@ Pager *pager_open(const char *file_name) {
     pager->file_descriptor = fd;
     pager->file_length = file_length;
     pager->num_pages = (file_length / PAGE_SIZE);
+    pager->compressed = false;
 
     for (u_int32_t i = 0; i < TABLE_MAX_PAGES; i++) {
         pager->pages[i] = NULL;
+        pager->page_offsets[i] = 0;
+        pager->page_lengths[i] = 0;
+        pager->page_capacities[i] = 0;
+        pager->dirty[i] = false;
+        pager->page_changes[i] = 0;
+    }
+    pager->change_counter = 0;
+
+    if (file_length == 0) {
+        // 新文件才能选择格式，已有文件按magic判断
+        pager->compressed = compress;
+    } else {
+        char magic[PAGER_MAGIC_SIZE];
+        lseek(fd, PAGER_MAGIC_OFFSET, SEEK_SET);
+        ssize_t bytes_read = read(fd, magic, PAGER_MAGIC_SIZE);
+        if (bytes_read == PAGER_MAGIC_SIZE && memcmp(magic, PAGER_MAGIC, PAGER_MAGIC_SIZE) == 0) {
+            pager->compressed = true;
+        }
+    }
+
+    if (pager->compressed) {
+        pager->num_pages = 0;
+        if (file_length > 0) {
+            pager_read_header(pager);
+        }
+        // 压缩格式下file_length是追加新页的位置，数据从header之后开始
+        if (pager->file_length < PAGER_HEADER_SIZE) {
+            pager->file_length = PAGER_HEADER_SIZE;
+        }
     }
 
     return pager;
 }
 
+void pager_read_header(Pager *pager) {
+    void *header = malloc(PAGER_HEADER_SIZE);
+    lseek(pager->file_descriptor, 0, SEEK_SET);
+    ssize_t bytes_read = read(pager->file_descriptor, header, PAGER_HEADER_SIZE);
+    if (bytes_read != PAGER_HEADER_SIZE) {
+        printf("Error reading file header: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    // header来自文件，写进page map之前先检查，get_page只读检查过的位置
+    memcpy(&(pager->num_pages), header + PAGER_NUM_PAGES_OFFSET, PAGER_NUM_PAGES_SIZE);
+    if (pager->num_pages > TABLE_MAX_PAGES) {
+        printf("Corrupt file header: %d pages\n", pager->num_pages);
+        exit(EXIT_FAILURE);
+    }
+    uint32_t file_length = pager->file_length;
+    for (uint32_t i = 0; i < pager->num_pages; i++) {
+        void *entry = header + PAGER_PAGE_MAP_OFFSET + i * PAGE_MAP_ENTRY_SIZE;
+        uint32_t offset, length, capacity;
+        memcpy(&offset, entry, sizeof(uint32_t));
+        memcpy(&length, entry + sizeof(uint32_t), sizeof(uint32_t));
+        memcpy(&capacity, entry + 2 * sizeof(uint32_t), sizeof(uint32_t));
+        // 页必须在header之后、文件末尾之前，且不超过自己的slot
+        if (length > capacity || capacity > PAGE_SIZE
+            || (capacity > 0 && (offset < PAGER_HEADER_SIZE || length > file_length || offset > file_length - length))) {
+            printf("Corrupt file header: page %d\n", i);
+            exit(EXIT_FAILURE);
+        }
+        pager->page_offsets[i] = offset;
+        pager->page_lengths[i] = length;
+        pager->page_capacities[i] = capacity;
+        // 最后一个slot只写了length字节，追加新页要从slot末尾开始，否则这页原地变长时会覆盖新页
+        if (capacity > 0 && offset + capacity > pager->file_length) {
+            pager->file_length = offset + capacity;
+        }
+    }
+    free(header);
+}
+
+void pager_write_header(Pager *pager) {
+    void *header = calloc(1, PAGER_HEADER_SIZE);
+    memcpy(header + PAGER_MAGIC_OFFSET, PAGER_MAGIC, PAGER_MAGIC_SIZE);
+    memcpy(header + PAGER_NUM_PAGES_OFFSET, &(pager->num_pages), PAGER_NUM_PAGES_SIZE);
+    for (uint32_t i = 0; i < pager->num_pages; i++) {
+        void *entry = header + PAGER_PAGE_MAP_OFFSET + i * PAGE_MAP_ENTRY_SIZE;
+        memcpy(entry, &(pager->page_offsets[i]), sizeof(uint32_t));
+        memcpy(entry + sizeof(uint32_t), &(pager->page_lengths[i]), sizeof(uint32_t));
+        memcpy(entry + 2 * sizeof(uint32_t), &(pager->page_capacities[i]), sizeof(uint32_t));
+    }
+
+    lseek(pager->file_descriptor, 0, SEEK_SET);
+    ssize_t bytes_written = write(pager->file_descriptor, header, PAGER_HEADER_SIZE);
+    if (bytes_written == -1) {
+        printf("Error writing file header: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    free(header);
+}
+
+uint32_t get_unused_page_num(Pager *pager) {
+    // Until we start recycling free pages, new pages will always go onto the end of the database file
+    return pager->num_pages;
+}
+
 Cursor *table_start(Table *table) {
     Cursor *cursor = malloc(sizeof(Cursor));
     cursor->table = table;
@@ -110,6 +738,18 @@ Cursor *table_start(Table *table) {
 //    cursor->end_of_table = (table->num_rows == 0);
     cursor->page_num = table->root_page_num;
     cursor->cell_num = 0;
+    cursor->directory_index = 0;
+
+    if (table->access_method == ACCESS_METHOD_HASH) {
+        // 从directory第0项指向的bucket开始，空bucket跳过
+        void *directory = get_page(table->pager, table->root_page_num);
+        cursor->page_num = *hash_directory_entry(directory, 0);
+        cursor->end_of_table = false;
+        if (*leaf_node_num_cells(get_page(table->pager, cursor->page_num)) == 0) {
+            hash_cursor_next_bucket(cursor);
+        }
+        return cursor;
+    }
 
     void *root_node = get_page(table->pager, table->root_page_num);
     uint32_t num_cells = *leaf_node_num_cells(root_node);
@@ -118,34 +758,164 @@ Cursor *table_start(Table *table) {
     return cursor;
 }
 
-Cursor *table_end(Table *table) {
+Cursor *table_find(Table *table, uint32_t key) {
+    // 返回key所在的位置；key不存在时返回key应该插入的位置
+    if (table->access_method == ACCESS_METHOD_HASH) {
+        return hash_find(table, key);
+    }
+    // 目前只有一个root leaf node，还没有internal node
+    return leaf_node_find(table, table->root_page_num, key);
+}
+
+Cursor *leaf_node_find(Table *table, uint32_t page_num, uint32_t key) {
+    void *node = get_page(table->pager, page_num);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+
     Cursor *cursor = malloc(sizeof(Cursor));
     cursor->table = table;
-//    cursor->row_num = table->num_rows;
-    cursor->page_num = table->root_page_num;
+    cursor->page_num = page_num;
+    cursor->directory_index = 0;
+    cursor->end_of_table = false;
+
+    // Binary search
+    uint32_t min_index = 0;
+    uint32_t one_past_max_index = num_cells;
+    while (one_past_max_index != min_index) {
+        uint32_t index = min_index + (one_past_max_index - min_index) / 2;
+        uint32_t key_at_index = *leaf_node_key(node, index);
+        if (key == key_at_index) {
+            cursor->cell_num = index;
+            return cursor;
+        }
+        if (key < key_at_index) {
+            one_past_max_index = index;
+        } else {
+            min_index = index + 1;
+        }
+    }
 
-    void *root_node = get_page(table->pager, table->root_page_num);
-    uint32_t num_cells = *leaf_node_num_cells(root_node);
-    cursor->cell_num = num_cells;
-    cursor->end_of_table = true;
+    cursor->cell_num = min_index;
+    return cursor;
+}
 
+Cursor *hash_find(Table *table, uint32_t key) {
+    // 用hash的低global_depth位在directory中找到bucket，bucket内按key有序，二分查找
+    void *directory = get_page(table->pager, table->root_page_num);
+    uint32_t global_depth = *hash_directory_global_depth(directory);
+    uint32_t index = hash_key(key) & ((1u << global_depth) - 1);
+    Cursor *cursor = leaf_node_find(table, *hash_directory_entry(directory, index), key);
+    cursor->directory_index = index;
     return cursor;
 }
 
-PrepareResult prepare_statement(InputBuffer *input_buffer, Statement *statement) {
-    // 比如：insert 1 cstack foo@bar.com
+uint32_t hash_key(uint32_t key) {
+    // murmur3的fmix32，让连续的id也能均匀分布到低位
+    key ^= key >> 16;
+    key *= 0x85ebca6b;
+    key ^= key >> 13;
+    key *= 0xc2b2ae35;
+    key ^= key >> 16;
+    return key;
+}
+
+bool hash_split_bucket(Table *table, uint32_t page_num) {
+    // 分裂一个满了的bucket，只改这个bucket、一个新bucket和directory这一页
+    // local depth已经等于global depth时先把directory翻倍；directory或文件满了返回false
+    Pager *pager = table->pager;
+    void *directory = get_page(pager, table->root_page_num);
+    void *bucket = get_page(pager, page_num);
+    uint32_t global_depth = *hash_directory_global_depth(directory);
+    uint32_t local_depth = *hash_bucket_local_depth(bucket);
+
+    if (local_depth == global_depth && global_depth >= HASH_DIRECTORY_MAX_GLOBAL_DEPTH) {
+        return false;
+    }
+    uint32_t new_page_num = get_unused_page_num(pager);
+    if (new_page_num >= TABLE_MAX_PAGES) {
+        return false;
+    }
+
+    if (local_depth == global_depth) {
+        // directory翻倍：后一半复制前一半
+        uint32_t size = 1u << global_depth;
+        memcpy(hash_directory_entry(directory, size), hash_directory_entry(directory, 0), size * HASH_DIRECTORY_ENTRY_SIZE);
+        global_depth += 1;
+        *hash_directory_global_depth(directory) = global_depth;
+    }
+
+    void *new_bucket = get_page(pager, new_page_num);
+    uint32_t cell_size = *leaf_node_cell_size(bucket);
+    initialize_hash_bucket(new_bucket, cell_size, local_depth + 1);
+    *hash_bucket_local_depth(bucket) = local_depth + 1;
+
+    // hash第local_depth位为1的cell移到新bucket，两边仍按key有序
+    uint32_t num_cells = *leaf_node_num_cells(bucket);
+    uint32_t num_kept = 0;
+    for (uint32_t i = 0; i < num_cells; i++) {
+        void *cell = leaf_node_cell(bucket, i);
+        if ((hash_key(*leaf_node_key(bucket, i)) >> local_depth) & 1) {
+            memcpy(leaf_node_cell(new_bucket, *leaf_node_num_cells(new_bucket)), cell, cell_size);
+            *leaf_node_num_cells(new_bucket) += 1;
+        } else {
+            if (num_kept != i) {
+                memcpy(leaf_node_cell(bucket, num_kept), cell, cell_size);
+            }
+            num_kept++;
+        }
+    }
+    *leaf_node_num_cells(bucket) = num_kept;
+
+    // 原来指向这个bucket、且第local_depth位为1的下标改指新bucket
+    for (uint32_t i = 0; i < (1u << global_depth); i++) {
+        if (*hash_directory_entry(directory, i) == page_num && ((i >> local_depth) & 1)) {
+            *hash_directory_entry(directory, i) = new_page_num;
+        }
+    }
+
+    pager_mark_dirty(pager, table->root_page_num);
+    pager_mark_dirty(pager, page_num);
+    pager_mark_dirty(pager, new_page_num);
+    return true;
+}
+
+void hash_cursor_next_bucket(Cursor *cursor) {
+    // 移到下一个非空bucket；一个bucket被2^(global_depth - local_depth)个下标指向，只在最小的下标处访问
+    Pager *pager = cursor->table->pager;
+    void *directory = get_page(pager, cursor->table->root_page_num);
+    uint32_t global_depth = *hash_directory_global_depth(directory);
+    for (uint32_t i = cursor->directory_index + 1; i < (1u << global_depth); i++) {
+        uint32_t page_num = *hash_directory_entry(directory, i);
+        void *bucket = get_page(pager, page_num);
+        if (i >= (1u << *hash_bucket_local_depth(bucket)) || *leaf_node_num_cells(bucket) == 0) {
+            continue;
+        }
+        cursor->directory_index = i;
+        cursor->page_num = page_num;
+        cursor->cell_num = 0;
+        return;
+    }
+    cursor->end_of_table = true;
+}
+
+PrepareResult prepare_statement(InputBuffer *input_buffer, Database *db, Statement *statement) {
+    // 比如：insert 1 cstack foo@bar.com 或 insert or replace into users 1 cstack foo@bar.com
     if (strncmp(input_buffer->buffer, "insert", 6) == 0) {
-        return prepare_insert(input_buffer, statement);
+        return prepare_insert(input_buffer, db, statement);
     }
+    // 比如：select 或 select * from users
     if (strncmp(input_buffer->buffer, "select", 6) == 0) {
-        statement->type = STATEMENT_SELECT;
-        return PREPARE_SUCCESS;
+        return prepare_select(input_buffer, db, statement);
+    }
+    // 比如：create table users (id int, username text(32), email text(255))
+    if (strncmp(input_buffer->buffer, "create table", 12) == 0) {
+        return prepare_create_table(input_buffer, statement);
     }
     return PREPARE_UNRECOGNIZED_STATEMENT;
 }
 
-PrepareResult prepare_insert(InputBuffer *input_buffer, Statement *statement) {
-    statement->type = STATEMENT_INSERT;
+PrepareResult prepare_insert(InputBuffer *input_buffer, Database *db, Statement *statement) {
+    bool replace = strncmp(input_buffer->buffer, "insert or replace", 17) == 0;
+    statement->type = replace ? STATEMENT_REPLACE : STATEMENT_INSERT;
     /*
     // 记录一个错误，user_name和email是char数组，可认为是指针，不用加&
     // int args_assigned = sscanf(input_buffer->buffer, "insert %d %s %s", &(statement->row_insert.id), &(statement->row_insert.username), &(statement->row_insert.email));
@@ -160,55 +930,221 @@ PrepareResult prepare_insert(InputBuffer *input_buffer, Statement *statement) {
     */
 //    char *keyword = strtok(input_buffer->buffer, " ");
     strtok(input_buffer->buffer, " ");
-    char *id_string = strtok(NULL, " ");
-    char *username = strtok(NULL, " ");
-    char *email = strtok(NULL, " ");
-    if (id_string == NULL || username == NULL || email == NULL) {
+    if (replace) {
+        // 跳过"or replace"
+        strtok(NULL, " ");
+        strtok(NULL, " ");
+    }
+    // 没有into时插入默认表
+    const char *table_name = DEFAULT_TABLE_NAME;
+    char *value = strtok(NULL, " ");
+    if (value != NULL && strcmp(value, "into") == 0) {
+        table_name = strtok(NULL, " ");
+        if (table_name == NULL) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        value = strtok(NULL, " ");
+    }
+    Table *table = db_find_table(db, table_name);
+    if (table == NULL) {
+        return PREPARE_TABLE_NOT_FOUND;
+    }
+    statement->table = table;
+
+    Schema *schema = &(table->schema);
+    for (uint32_t i = 0; i < schema->num_columns; i++) {
+        if (value == NULL) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        PrepareResult result = row_set_value(schema, statement->row_insert, i, value);
+        if (result != PREPARE_SUCCESS) {
+            return result;
+        }
+        value = strtok(NULL, " ");
+    }
+    if (value != NULL) {
         return PREPARE_SYNTAX_ERROR;
     }
-    int id = atoi(id_string);
-//    int id = strtol(id_string, NULL, 10);
-    if (id < 1) {
-        return PREPARE_NEGATIVE_ID;
+
+//    printf("id:%d,username:%s,email:%s\n", statement->row_insert.id, statement->row_insert.username, statement->row_insert.email);
+    return PREPARE_SUCCESS;
+}
+
+PrepareResult prepare_select(InputBuffer *input_buffer, Database *db, Statement *statement) {
+    statement->type = STATEMENT_SELECT;
+    strtok(input_buffer->buffer, " ");
+    // 没有from时查询默认表
+    const char *table_name = DEFAULT_TABLE_NAME;
+    char *token = strtok(NULL, " ");
+    if (token != NULL) {
+        if (strcmp(token, "*") != 0) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        token = strtok(NULL, " ");
+        if (token == NULL || strcmp(token, "from") != 0) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        table_name = strtok(NULL, " ");
+        if (table_name == NULL) {
+            return PREPARE_SYNTAX_ERROR;
+        }
     }
-//    printf("strlen(username):%lu\n", strlen(username));
-    if (strlen(username) > COLUMN_USERNAME_SIZE) {
-        return PREPARE_STRING_TOO_LONG;
+    Table *table = db_find_table(db, table_name);
+    if (table == NULL) {
+        return PREPARE_TABLE_NOT_FOUND;
     }
-    if (strlen(email) > COLUMN_EMAIL_SIZE) {
+    statement->table = table;
+
+    // 比如：select * from users where id = 1，只支持按主键精确查找
+    statement->has_key = false;
+    token = strtok(NULL, " ");
+    if (token != NULL) {
+        if (strcmp(token, "where") != 0) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        char *column_name = strtok(NULL, " =");
+        char *value = strtok(NULL, " =");
+        if (column_name == NULL || value == NULL || strcmp(column_name, table->schema.columns[0].name) != 0) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        int key = atoi(value);
+        if (key < 1) {
+            return PREPARE_NEGATIVE_ID;
+        }
+        statement->has_key = true;
+        statement->key = key;
+    }
+    return PREPARE_SUCCESS;
+}
+
+PrepareResult prepare_create_table(InputBuffer *input_buffer, Statement *statement) {
+    statement->type = STATEMENT_CREATE_TABLE;
+    // 跳过"create table"
+    strtok(input_buffer->buffer, " ");
+    strtok(NULL, " ");
+    char *table_name = strtok(NULL, " (");
+    if (table_name == NULL) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if (strlen(table_name) > TABLE_NAME_SIZE) {
         return PREPARE_STRING_TOO_LONG;
     }
-    statement->row_insert->id = id;
-    // 报错，改成strcpy
-//     statement->row_insert.username = username;
-    // statement->row_insert.email = email;
-    strcpy(statement->row_insert->username, username);
-    strcpy(statement->row_insert->email, email);
+    strcpy(statement->table_name, table_name);
+
+    // 列定义：name int 或 name text(size)，用逗号分隔
+    Schema *schema = &(statement->schema);
+    schema->num_columns = 0;
+    statement->access_method = ACCESS_METHOD_BTREE;
+    char *column_name;
+    while ((column_name = strtok(NULL, " ,()")) != NULL) {
+        // 比如：create table cache (id int, value text(16)) using hash
+        if (strcmp(column_name, "using") == 0) {
+            char *access_method = strtok(NULL, " ");
+            if (access_method == NULL || strtok(NULL, " ") != NULL) {
+                return PREPARE_SYNTAX_ERROR;
+            }
+            if (strcmp(access_method, "hash") == 0) {
+                statement->access_method = ACCESS_METHOD_HASH;
+            } else if (strcmp(access_method, "btree") != 0) {
+                return PREPARE_SYNTAX_ERROR;
+            }
+            break;
+        }
+        if (schema->num_columns >= TABLE_MAX_COLUMNS) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        char *column_type = strtok(NULL, " ,()");
+        if (column_type == NULL) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        if (strlen(column_name) > COLUMN_NAME_SIZE) {
+            return PREPARE_STRING_TOO_LONG;
+        }
+        Column *column = &(schema->columns[schema->num_columns]);
+        strcpy(column->name, column_name);
+        if (strcmp(column_type, "int") == 0) {
+            column->type = COLUMN_INT;
+            column->size = sizeof(uint32_t);
+        } else if (strcmp(column_type, "text") == 0) {
+            char *size_string = strtok(NULL, " ,()");
+            if (size_string == NULL) {
+                return PREPARE_SYNTAX_ERROR;
+            }
+            // strtol溢出时返回LONG_MAX，不会像atoi一样变成负数或者截断
+            long size = strtol(size_string, NULL, 10);
+            if (size < 1) {
+                return PREPARE_SYNTAX_ERROR;
+            }
+            if (size > ROW_MAX_SIZE) {
+                return PREPARE_STRING_TOO_LONG;
+            }
+            column->type = COLUMN_TEXT;
+            column->size = size;
+        } else {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        schema->num_columns += 1;
+    }
 
-//    printf("id:%d,username:%s,email:%s\n", statement->row_insert.id, statement->row_insert.username, statement->row_insert.email);
+    // 第一列是主键，必须是int
+    if (schema->num_columns == 0 || schema->columns[0].type != COLUMN_INT) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if (!schema_compute_layout(schema)) {
+        return PREPARE_STRING_TOO_LONG;
+    }
     return PREPARE_SUCCESS;
 }
 
-ExecuteResult execute_statement(Statement *statement, Table *table) {
+ExecuteResult execute_statement(Statement *statement, Database *db) {
     switch (statement->type) {
         case (STATEMENT_INSERT):
-            return execute_insert(statement, table);
+            return execute_insert(statement, statement->table, false);
+        case (STATEMENT_REPLACE):
+            return execute_insert(statement, statement->table, true);
         case (STATEMENT_SELECT):
-            return execute_select(statement, table);
+            return execute_select(statement, statement->table);
+        case (STATEMENT_CREATE_TABLE):
+            return execute_create_table(statement, db);
     }
 }
 
-ExecuteResult execute_insert(Statement *statement, Table *table) {
+ExecuteResult execute_insert(Statement *statement, Table *table, bool replace) {
 //    if (table->num_rows >= TABLE_MAX_ROWS) {
 //        return EXECUTE_TABLE_FULL;
 //    }
-    void *node = get_page(table->pager, table->root_page_num);
-    if ((*leaf_node_num_cells(node) >= LEAF_NODE_MAX_CELLS)) {
-        return EXECUTE_TABLE_FULL;
+    // replace为true时是insert or replace：key已存在就原地覆盖value
+    Row *row_to_insert = statement->row_insert;
+    uint32_t key_to_insert = row_to_insert->id;
+//    Cursor *cursor = table_end(table);
+    Cursor *cursor = table_find(table, key_to_insert);
+    void *node = get_page(table->pager, cursor->page_num);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+
+    if (cursor->cell_num < num_cells) {
+        uint32_t key_at_index = *leaf_node_key(node, cursor->cell_num);
+        if (key_at_index == key_to_insert) {
+            if (!replace) {
+                free(cursor);
+                return EXECUTE_DUPLICATE_KEY;
+            }
+            // 不需要先delete再insert
+            serialize_row(&(table->schema), row_to_insert, leaf_node_value(node, cursor->cell_num));
+            pager_mark_dirty(table->pager, cursor->page_num);
+            free(cursor);
+            return EXECUTE_SUCCESS;
+        }
     }
 
-    Row *row_to_insert = statement->row_insert;
-    Cursor *cursor = table_end(table);
+    if (num_cells >= leaf_node_max_cells(node)) {
+        uint32_t page_num = cursor->page_num;
+        free(cursor);
+        // hash表的bucket满了就分裂，然后重新插入
+        if (table->access_method == ACCESS_METHOD_HASH && hash_split_bucket(table, page_num)) {
+            return execute_insert(statement, table, replace);
+        }
+        return EXECUTE_TABLE_FULL;
+    }
 
 //    serialize_row(row_to_insert, row_slot(table, table->num_rows));
 //    serialize_row(row_to_insert, cursor_value(cursor));
@@ -224,7 +1160,7 @@ void leaf_node_insert(Cursor *cursor, uint32_t key, Row *value) {
     void *node = get_page(cursor->table->pager, cursor->page_num);
 
     uint32_t num_cells = *leaf_node_num_cells(node);
-    if (num_cells >= LEAF_NODE_MAX_CELLS) {
+    if (num_cells >= leaf_node_max_cells(node)) {
         printf("Need to implement splitting a leaf node.\n");
         exit(EXIT_FAILURE);
     }
@@ -232,24 +1168,38 @@ void leaf_node_insert(Cursor *cursor, uint32_t key, Row *value) {
     if (cursor->cell_num < num_cells) {
         // Make room for new cell
         for (uint32_t i = num_cells; i > cursor->cell_num; i--) {
-            memcpy(leaf_node_cell(node, i), leaf_node_cell(node, i - 1), LEAF_NODE_CELL_SIZE);
+            memcpy(leaf_node_cell(node, i), leaf_node_cell(node, i - 1), *leaf_node_cell_size(node));
         }
     }
 
     *(leaf_node_num_cells(node)) += 1;
     *(leaf_node_key(node, cursor->cell_num)) = key;
-    serialize_row(value, leaf_node_value(node, cursor->cell_num));
+    serialize_row(&(cursor->table->schema), value, leaf_node_value(node, cursor->cell_num));
+    pager_mark_dirty(cursor->table->pager, cursor->page_num);
 }
 
 ExecuteResult execute_select(Statement *statement, Table *table) {
+    Row row;
+    if (statement->has_key) {
+        // 按主键查找：B-tree二分查找，hash表只读一个bucket
+        Cursor *cursor = table_find(table, statement->key);
+        void *node = get_page(table->pager, cursor->page_num);
+        if (cursor->cell_num < *leaf_node_num_cells(node) && *leaf_node_key(node, cursor->cell_num) == statement->key) {
+            deserialize_row(&(table->schema), cursor_value(cursor), &row);
+            print_row(&(table->schema), &row);
+        }
+        free(cursor);
+        return EXECUTE_SUCCESS;
+    }
+
     Cursor *cursor = table_start(table);
 
-    Row row;
     while (!cursor->end_of_table) {
-        deserialize_row(cursor_value(cursor), &row);
-        print_row(&row);
+        deserialize_row(&(table->schema), cursor_value(cursor), &row);
+        print_row(&(table->schema), &row);
         cursor_advance(cursor);
     }
+    free(cursor);
 
 //    for (uint32_t i = 0; i < table->num_rows; i++) {
 //        deserialize_row(row_slot(table, i), &row);
@@ -258,22 +1208,171 @@ ExecuteResult execute_select(Statement *statement, Table *table) {
     return EXECUTE_SUCCESS;
 }
 
-void serialize_row(Row *source, void *destination) {
+ExecuteResult execute_create_table(Statement *statement, Database *db) {
+    if (db_find_table(db, statement->table_name) != NULL) {
+        return EXECUTE_TABLE_EXISTS;
+    }
+    Table *catalog = db->catalog;
+    void *catalog_node = get_page(db->pager, catalog->root_page_num);
+    uint32_t num_cells = *leaf_node_num_cells(catalog_node);
+    if (num_cells >= leaf_node_max_cells(catalog_node) || db->num_tables >= DATABASE_MAX_TABLES) {
+        return EXECUTE_TABLE_FULL;
+    }
+
+    Table *table = malloc(sizeof(Table));
+    table->pager = db->pager;
+    // catalog按table_id有序，新表取最大的table_id + 1
+    table->table_id = num_cells == 0 ? 1 : *leaf_node_key(catalog_node, num_cells - 1) + 1;
+    strcpy(table->name, statement->table_name);
+    table->schema = statement->schema;
+    schema_compute_layout(&(table->schema));
+    table->access_method = statement->access_method;
+    table->root_page_num = get_unused_page_num(db->pager);
+    uint32_t cell_size = LEAF_NODE_KEY_SIZE + table->schema.row_size;
+    // 文件已经用满时get_page会直接退出，先检查；hash表还需要一页给bucket
+    uint32_t num_new_pages = table->access_method == ACCESS_METHOD_HASH ? 2 : 1;
+    if (table->root_page_num + num_new_pages > TABLE_MAX_PAGES) {
+        free(table);
+        return EXECUTE_TABLE_FULL;
+    }
+    if (table->access_method == ACCESS_METHOD_HASH) {
+        // global depth为0的directory，唯一的一项指向一个空bucket
+        initialize_hash_directory(get_page(db->pager, table->root_page_num));
+        uint32_t bucket_page_num = get_unused_page_num(db->pager);
+        initialize_hash_bucket(get_page(db->pager, bucket_page_num), cell_size, 0);
+        *hash_directory_entry(get_page(db->pager, table->root_page_num), 0) = bucket_page_num;
+        pager_mark_dirty(db->pager, bucket_page_num);
+    } else {
+        initialize_leaf_node(get_page(db->pager, table->root_page_num), cell_size);
+    }
+    pager_mark_dirty(db->pager, table->root_page_num);
+
+    Row record;
+    serialize_catalog_record(table, record.data);
+    Cursor *cursor = table_find(catalog, table->table_id);
+    leaf_node_insert(cursor, table->table_id, &record);
+    free(cursor);
+
+    db->tables[db->num_tables] = table;
+    db->num_tables += 1;
+    return EXECUTE_SUCCESS;
+}
+
+bool schema_compute_layout(Schema *schema) {
+    // 一行超过ROW_MAX_SIZE时返回false；逐列检查，列宽和偏移量都不会溢出
+    uint32_t offset = 0;
+    for (uint32_t i = 0; i < schema->num_columns; i++) {
+        Column *column = &(schema->columns[i]);
+        if (column->type == COLUMN_TEXT && column->size >= ROW_MAX_SIZE) {
+            return false;
+        }
+        // 注意+1
+        //  C strings are supposed to end with a null character, which we should allocate space for.
+        column->width = column->type == COLUMN_INT ? sizeof(uint32_t) : column->size + 1;
+        if (column->width > ROW_MAX_SIZE - offset) {
+            return false;
+        }
+        column->offset = offset;
+        offset += column->width;
+    }
+    schema->row_size = offset;
+    return true;
+}
+
+PrepareResult row_set_value(Schema *schema, Row *row, uint32_t column_num, const char *value) {
+    Column *column = &(schema->columns[column_num]);
+    if (column->type == COLUMN_INT) {
+        int number = atoi(value);
+//    int id = strtol(id_string, NULL, 10);
+        // 第一列是主键
+        if (column_num == 0) {
+            if (number < 1) {
+                return PREPARE_NEGATIVE_ID;
+            }
+            row->id = number;
+        }
+        memcpy(row->data + column->offset, &number, column->width);
+    } else {
+//    printf("strlen(username):%lu\n", strlen(username));
+        size_t length = strlen(value);
+        if (length > column->size) {
+            return PREPARE_STRING_TOO_LONG;
+        }
+        // 剩余字节补0，避免把未初始化的内存写进文件
+        memset(row->data + column->offset, 0, column->width);
+        memcpy(row->data + column->offset, value, length);
+    }
+    return PREPARE_SUCCESS;
+}
+
+void serialize_row(Schema *schema, Row *source, void *destination) {
     // void *memcpy(void *restrict s1, const void *restrict s2, size_t n);
     // The memcpy() function shall copy n bytes from the object pointed to by s2 into the object pointed to by s1.
     // If copying takes place between objects that overlap, the behavior is undefined.
-    memcpy(destination + ID_OFFSET, &(source->id), ID_SIZE);
-    memcpy(destination + USERNAME_OFFSET, source->username, USERNAME_SIZE);
-    memcpy(destination + EMAIL_OFFSET, source->email, EMAIL_SIZE);
+    // Row.data已经是按schema的偏移量编码好的
+    memcpy(destination, source->data, schema->row_size);
 }
 
-void deserialize_row(void *source, Row *destination) {
+void deserialize_row(Schema *schema, void *source, Row *destination) {
     // void *memcpy(void *restrict s1, const void *restrict s2, size_t n);
     // The memcpy() function shall copy n bytes from the object pointed to by s2 into the object pointed to by s1.
     // If copying takes place between objects that overlap, the behavior is undefined.
-    memcpy(&(destination->id), source + ID_OFFSET, ID_SIZE);
-    memcpy(&(destination->username), source + USERNAME_OFFSET, USERNAME_SIZE);
-    memcpy(&(destination->email), source + EMAIL_OFFSET, EMAIL_SIZE);
+    memcpy(destination->data, source, schema->row_size);
+    memcpy(&(destination->id), source + schema->columns[0].offset, sizeof(uint32_t));
+}
+
+void serialize_catalog_record(Table *source, void *destination) {
+    memset(destination, 0, CATALOG_RECORD_SIZE);
+    memcpy(destination + CATALOG_TABLE_ID_OFFSET, &(source->table_id), CATALOG_TABLE_ID_SIZE);
+    memcpy(destination + CATALOG_ROOT_PAGE_NUM_OFFSET, &(source->root_page_num), CATALOG_ROOT_PAGE_NUM_SIZE);
+    memcpy(destination + CATALOG_NAME_OFFSET, source->name, CATALOG_NAME_SIZE);
+    memcpy(destination + CATALOG_NUM_COLUMNS_OFFSET, &(source->schema.num_columns), CATALOG_NUM_COLUMNS_SIZE);
+    for (uint32_t i = 0; i < source->schema.num_columns; i++) {
+        Column *column = &(source->schema.columns[i]);
+        void *column_record = destination + CATALOG_COLUMNS_OFFSET + i * CATALOG_COLUMN_RECORD_SIZE;
+        uint32_t type = column->type;
+        memcpy(column_record + CATALOG_COLUMN_NAME_OFFSET, column->name, CATALOG_COLUMN_NAME_SIZE);
+        memcpy(column_record + CATALOG_COLUMN_TYPE_OFFSET, &type, CATALOG_COLUMN_TYPE_SIZE);
+        memcpy(column_record + CATALOG_COLUMN_SIZE_OFFSET, &(column->size), CATALOG_COLUMN_SIZE_SIZE);
+    }
+    uint32_t access_method = source->access_method;
+    memcpy(destination + CATALOG_ACCESS_METHOD_OFFSET, &access_method, CATALOG_ACCESS_METHOD_SIZE);
+}
+
+bool deserialize_catalog_record(void *source, Table *destination) {
+    // record来自文件，列数、类型、access method不合法时返回false
+    memcpy(&(destination->table_id), source + CATALOG_TABLE_ID_OFFSET, CATALOG_TABLE_ID_SIZE);
+    memcpy(&(destination->root_page_num), source + CATALOG_ROOT_PAGE_NUM_OFFSET, CATALOG_ROOT_PAGE_NUM_SIZE);
+    memcpy(destination->name, source + CATALOG_NAME_OFFSET, CATALOG_NAME_SIZE);
+    destination->name[TABLE_NAME_SIZE] = '\0';
+    memcpy(&(destination->schema.num_columns), source + CATALOG_NUM_COLUMNS_OFFSET, CATALOG_NUM_COLUMNS_SIZE);
+    if (destination->schema.num_columns == 0 || destination->schema.num_columns > TABLE_MAX_COLUMNS) {
+        return false;
+    }
+    for (uint32_t i = 0; i < destination->schema.num_columns; i++) {
+        Column *column = &(destination->schema.columns[i]);
+        void *column_record = source + CATALOG_COLUMNS_OFFSET + i * CATALOG_COLUMN_RECORD_SIZE;
+        uint32_t type;
+        memcpy(column->name, column_record + CATALOG_COLUMN_NAME_OFFSET, CATALOG_COLUMN_NAME_SIZE);
+        column->name[COLUMN_NAME_SIZE] = '\0';
+        memcpy(&type, column_record + CATALOG_COLUMN_TYPE_OFFSET, CATALOG_COLUMN_TYPE_SIZE);
+        memcpy(&(column->size), column_record + CATALOG_COLUMN_SIZE_OFFSET, CATALOG_COLUMN_SIZE_SIZE);
+        if (type != COLUMN_INT && type != COLUMN_TEXT) {
+            return false;
+        }
+        column->type = (ColumnType) type;
+    }
+    // 第一列是主键，必须是int
+    if (destination->schema.columns[0].type != COLUMN_INT) {
+        return false;
+    }
+    uint32_t access_method;
+    memcpy(&access_method, source + CATALOG_ACCESS_METHOD_OFFSET, CATALOG_ACCESS_METHOD_SIZE);
+    if (access_method != ACCESS_METHOD_BTREE && access_method != ACCESS_METHOD_HASH) {
+        return false;
+    }
+    destination->access_method = (AccessMethod) access_method;
+    return true;
 }
 
 // row_slot:返回当前page指针指向的内存地址（或者说指向第几row），用内存偏移量表示
@@ -310,7 +1409,11 @@ void cursor_advance(Cursor *cursor) {
     void *node = get_page(cursor->table->pager, page_num);
     cursor->cell_num += 1;
     if (cursor->cell_num >= (*leaf_node_num_cells(node))) {
-        cursor->end_of_table = true;
+        if (cursor->table->access_method == ACCESS_METHOD_HASH) {
+            hash_cursor_next_bucket(cursor);
+        } else {
+            cursor->end_of_table = true;
+        }
     }
 }
 
@@ -322,7 +1425,8 @@ void *get_page(Pager *pager, uint32_t page_num) {
 
     if (pager->pages[page_num] == NULL) {
         // Cache miss. Allocate memory and load from file.
-        void *page = malloc(PAGE_SIZE);
+        // 新页清零，未使用的空间不会把随机内容写进文件
+        void *page = calloc(1, PAGE_SIZE);
         u_int32_t num_pages = pager->file_length / PAGE_SIZE;
 
         // We might save a partial page at the end of the file
@@ -330,7 +1434,25 @@ void *get_page(Pager *pager, uint32_t page_num) {
             num_pages += 1;
         }
 
-        if (page_num <= num_pages) {
+        if (pager->compressed) {
+            uint32_t length = pager->page_lengths[page_num];
+            if (page_num < pager->num_pages && length > 0) {
+                void *buffer = length == PAGE_SIZE ? page : malloc(length);
+                lseek(pager->file_descriptor, pager->page_offsets[page_num], SEEK_SET);
+                ssize_t bytes_read = read(pager->file_descriptor, buffer, length);
+                if (bytes_read != length) {
+                    printf("Error reading file: %d\n", errno);
+                    exit(EXIT_FAILURE);
+                }
+                if (buffer != page) {
+                    if (!page_decompress(buffer, length, page, PAGE_SIZE)) {
+                        printf("Error decompressing page %d\n", page_num);
+                        exit(EXIT_FAILURE);
+                    }
+                    free(buffer);
+                }
+            }
+        } else if (page_num <= num_pages) {
             lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
             ssize_t bytes_read = read(pager->file_descriptor, page, PAGE_SIZE);
             if (bytes_read == -1) {
@@ -348,8 +1470,22 @@ void *get_page(Pager *pager, uint32_t page_num) {
     return pager->pages[page_num];
 }
 
-void print_row(Row *row) {
-    printf("(%d, %s, %s)\n", row->id, row->username, row->email);
+void print_row(Schema *schema, Row *row) {
+    printf("(");
+    for (uint32_t i = 0; i < schema->num_columns; i++) {
+        Column *column = &(schema->columns[i]);
+        if (column->type == COLUMN_INT) {
+            int32_t number;
+            memcpy(&number, row->data + column->offset, sizeof(int32_t));
+            printf("%d", number);
+        } else {
+            printf("%s", (char *) (row->data + column->offset));
+        }
+        if (i + 1 < schema->num_columns) {
+            printf(", ");
+        }
+    }
+    printf(")\n");
 }
 
 void read_input(InputBuffer *input_buffer) {
@@ -372,19 +1508,20 @@ void close_input_buffer(InputBuffer *input_buffer) {
     free(input_buffer);
 }
 
-void *db_close(Table *table) {
-    Pager *pager = table->pager;
-//    uint32_t num_full_pages = table->num_rows / ROWS_PER_PAGE;
+void *db_close(Database *db) {
+    pager_close(db->pager, true);
+    for (uint32_t i = 0; i < db->num_tables; i++) {
+        free(db->tables[i]);
+    }
+    free(db->tables);
+    free(db->catalog);
+    free(db->file_name);
+    free(db);
+}
 
-//    for (uint32_t i = 0; i < num_full_pages; i++) {
-    for (uint32_t i = 0; i < pager->num_pages; i++) {
-        if (pager->pages[i] == NULL) {
-            continue;
-        }
-//        pager_flush(pager, i, PAGE_SIZE);
-        pager_flush(pager, i);
-        free(pager->pages[i]);
-        pager->pages[i] = NULL;
+void pager_close(Pager *pager, bool flush) {
+    if (flush) {
+        pager_flush_all(pager);
     }
 
     // There may be a partial page to write to the end of the file
@@ -412,7 +1549,24 @@ void *db_close(Table *table) {
     }
 
     free(pager);
-    free(table);
+}
+
+void pager_flush_all(Pager *pager) {
+//    uint32_t num_full_pages = table->num_rows / ROWS_PER_PAGE;
+
+//    for (uint32_t i = 0; i < num_full_pages; i++) {
+    for (uint32_t i = 0; i < pager->num_pages; i++) {
+        // 只写回修改过的页
+        if (pager->pages[i] == NULL || !pager->dirty[i]) {
+            continue;
+        }
+//        pager_flush(pager, i, PAGE_SIZE);
+        pager_flush(pager, i);
+    }
+    // 页的位置可能变了，最后写page map
+    if (pager->compressed) {
+        pager_write_header(pager);
+    }
 }
 
 //void pager_flush(Pager *pager, uint32_t page_num, uint32_t size) {
@@ -422,6 +1576,39 @@ void pager_flush(Pager *pager, uint32_t page_num) {
         exit(EXIT_FAILURE);
     }
 
+    if (pager->compressed) {
+        void *page = pager->pages[page_num];
+        uint8_t *buffer = malloc(PAGE_SIZE);
+        uint32_t length = page_compress(page, PAGE_SIZE, buffer, PAGE_SIZE - 1);
+        // 压缩后没有变小就按原样存
+        void *data = length == 0 ? page : buffer;
+        if (length == 0) {
+            length = PAGE_SIZE;
+        }
+        if (length > pager->page_capacities[page_num]) {
+            // 原来的位置放不下，追加到文件末尾，旧位置留给.vacuum回收
+            uint32_t capacity = (length + PAGE_SLOT_ALIGNMENT - 1) / PAGE_SLOT_ALIGNMENT * PAGE_SLOT_ALIGNMENT;
+            pager->page_offsets[page_num] = pager->file_length;
+            pager->page_capacities[page_num] = capacity;
+            pager->file_length += capacity;
+        }
+        pager->page_lengths[page_num] = length;
+
+        off_t offset = lseek(pager->file_descriptor, pager->page_offsets[page_num], SEEK_SET);
+        if (offset == -1) {
+            printf("Error seeking: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        ssize_t bytes_written = write(pager->file_descriptor, data, length);
+        if (bytes_written == -1) {
+            printf("Error writing: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        free(buffer);
+        pager->dirty[page_num] = false;
+        return;
+    }
+
     off_t offset = lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
     if (offset == -1) {
         printf("Error seeking: %d\n", errno);
@@ -434,14 +1621,131 @@ void pager_flush(Pager *pager, uint32_t page_num) {
         printf("Error writing: %d\n", errno);
         exit(EXIT_FAILURE);
     }
+    if ((page_num + 1) * PAGE_SIZE > pager->file_length) {
+        pager->file_length = (page_num + 1) * PAGE_SIZE;
+    }
+    pager->dirty[page_num] = false;
+}
+
+void pager_mark_dirty(Pager *pager, uint32_t page_num) {
+    pager->dirty[page_num] = true;
+    pager->change_counter += 1;
+    pager->page_changes[page_num] = pager->change_counter;
+}
+
+uint32_t page_compress(const uint8_t *source, uint32_t source_length, uint8_t *destination, uint32_t destination_capacity) {
+    // 记录每个3字节序列最近一次出现的位置，贪心地取最长match
+    // 返回压缩后的长度，destination放不下时返回0
+    int32_t hash_table[1 << LZ_HASH_BITS];
+    for (uint32_t i = 0; i < (1u << LZ_HASH_BITS); i++) {
+        hash_table[i] = -1;
+    }
+
+    uint32_t in = 0;
+    uint32_t out = 0;
+    uint32_t literal_start = 0;
+    while (in < source_length) {
+        uint32_t match_length = 0;
+        uint32_t match_offset = 0;
+        if (in + LZ_MIN_MATCH <= source_length) {
+            uint32_t sequence = source[in] << 16 | source[in + 1] << 8 | source[in + 2];
+            uint32_t hash = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+            int32_t candidate = hash_table[hash];
+            hash_table[hash] = in;
+            if (candidate >= 0 && in - candidate <= LZ_MAX_OFFSET) {
+                uint32_t max_length = source_length - in < LZ_MAX_MATCH ? source_length - in : LZ_MAX_MATCH;
+                while (match_length < max_length && source[candidate + match_length] == source[in + match_length]) {
+                    match_length++;
+                }
+                match_offset = in - candidate;
+            }
+        }
+
+        if (match_length >= LZ_MIN_MATCH) {
+            if (!lz_emit_literals(source, literal_start, in, destination, &out, destination_capacity)) {
+                return 0;
+            }
+            if (out + 3 > destination_capacity) {
+                return 0;
+            }
+            destination[out] = 0x80 | (match_length - LZ_MIN_MATCH);
+            destination[out + 1] = match_offset & 0xff;
+            destination[out + 2] = match_offset >> 8;
+            out += 3;
+            in += match_length;
+            literal_start = in;
+        } else {
+            in++;
+        }
+    }
+
+    if (!lz_emit_literals(source, literal_start, source_length, destination, &out, destination_capacity)) {
+        return 0;
+    }
+    return out;
+}
+
+bool lz_emit_literals(const uint8_t *source, uint32_t start, uint32_t end, uint8_t *destination, uint32_t *out, uint32_t destination_capacity) {
+    while (start < end) {
+        uint32_t length = end - start < LZ_MAX_LITERALS ? end - start : LZ_MAX_LITERALS;
+        if (*out + 1 + length > destination_capacity) {
+            return false;
+        }
+        destination[*out] = length - 1;
+        memcpy(destination + *out + 1, source + start, length);
+        *out += 1 + length;
+        start += length;
+    }
+    return true;
+}
+
+bool page_decompress(const uint8_t *source, uint32_t source_length, uint8_t *destination, uint32_t destination_length) {
+    uint32_t in = 0;
+    uint32_t out = 0;
+    while (in < source_length) {
+        uint8_t control = source[in++];
+        if ((control & 0x80) == 0) {
+            uint32_t length = control + 1;
+            if (in + length > source_length || out + length > destination_length) {
+                return false;
+            }
+            memcpy(destination + out, source + in, length);
+            in += length;
+            out += length;
+        } else {
+            uint32_t length = (control & 0x7f) + LZ_MIN_MATCH;
+            if (in + 2 > source_length) {
+                return false;
+            }
+            uint32_t offset = source[in] | source[in + 1] << 8;
+            in += 2;
+            if (offset == 0 || offset > out || out + length > destination_length) {
+                return false;
+            }
+            // match可能和自己重叠（比如一串0），只能逐字节复制
+            for (uint32_t i = 0; i < length; i++) {
+                destination[out + i] = destination[out - offset + i];
+            }
+            out += length;
+        }
+    }
+    return out == destination_length;
 }
 
 uint32_t *leaf_node_num_cells(void *node) {
     return node + LEAF_NODE_NUM_CELLS_OFFSET;
 }
 
+uint32_t *leaf_node_cell_size(void *node) {
+    return node + LEAF_NODE_CELL_SIZE_OFFSET;
+}
+
+uint32_t leaf_node_max_cells(void *node) {
+    return LEAF_NODE_SPACE_FOR_CELLS / *leaf_node_cell_size(node);
+}
+
 void *leaf_node_cell(void *node, uint32_t cell_num) {
-    return node + LEAF_NODE_HEADER_SIZE + cell_num * LEAF_NODE_CELL_SIZE;
+    return node + LEAF_NODE_HEADER_SIZE + cell_num * *leaf_node_cell_size(node);
 }
 
 uint32_t *leaf_node_key(void *node, uint32_t cell_num) {
@@ -452,8 +1756,61 @@ uint32_t *leaf_node_value(void *node, uint32_t cell_num) {
     return leaf_node_cell(node, cell_num) + LEAF_NODE_KEY_SIZE;
 }
 
-void initialize_leaf_node(void *node) {
+NodeType get_node_type(void *node) {
+    uint8_t value = *((uint8_t *) (node + NODE_TYPE_OFFSET));
+    return (NodeType) value;
+}
+
+void set_node_type(void *node, NodeType type) {
+    uint8_t value = type;
+    *((uint8_t *) (node + NODE_TYPE_OFFSET)) = value;
+}
+
+void initialize_leaf_node(void *node, uint32_t cell_size) {
+    set_node_type(node, NODE_LEAF);
     *leaf_node_num_cells(node) = 0;
+    *leaf_node_cell_size(node) = cell_size;
+}
+
+void initialize_catalog_node(void *node) {
+    initialize_leaf_node(node, LEAF_NODE_KEY_SIZE + CATALOG_RECORD_SIZE);
+    uint32_t version = DATABASE_FORMAT_VERSION;
+    memcpy(node + DATABASE_MAGIC_OFFSET, DATABASE_MAGIC, DATABASE_MAGIC_SIZE);
+    memcpy(node + DATABASE_VERSION_OFFSET, &version, DATABASE_VERSION_SIZE);
+}
+
+bool catalog_node_valid(void *node) {
+    // magic和版本号一致，且header里的字段不会让后面的读越界
+    uint32_t version;
+    memcpy(&version, node + DATABASE_VERSION_OFFSET, DATABASE_VERSION_SIZE);
+    return memcmp(node + DATABASE_MAGIC_OFFSET, DATABASE_MAGIC, DATABASE_MAGIC_SIZE) == 0
+           && version == DATABASE_FORMAT_VERSION
+           && get_node_type(node) == NODE_LEAF
+           && *leaf_node_cell_size(node) == LEAF_NODE_KEY_SIZE + CATALOG_RECORD_SIZE
+           && *leaf_node_num_cells(node) <= DATABASE_MAX_TABLES;
+}
+
+uint32_t *hash_directory_global_depth(void *node) {
+    return node + HASH_DIRECTORY_GLOBAL_DEPTH_OFFSET;
+}
+
+uint32_t *hash_directory_entry(void *node, uint32_t index) {
+    return node + HASH_DIRECTORY_HEADER_SIZE + index * HASH_DIRECTORY_ENTRY_SIZE;
+}
+
+uint32_t *hash_bucket_local_depth(void *node) {
+    return node + HASH_BUCKET_LOCAL_DEPTH_OFFSET;
+}
+
+void initialize_hash_directory(void *node) {
+    set_node_type(node, NODE_HASH_DIRECTORY);
+    *hash_directory_global_depth(node) = 0;
+}
+
+void initialize_hash_bucket(void *node, uint32_t cell_size, uint32_t local_depth) {
+    initialize_leaf_node(node, cell_size);
+    set_node_type(node, NODE_HASH_BUCKET);
+    *hash_bucket_local_depth(node) = local_depth;
 }
 
 //void free_table(Table *table) {
@@ -466,20 +1823,22 @@ void initialize_leaf_node(void *node) {
 int main(int argc, char const *argv[]) {
     // 初始化Table
 //    Table *table = new_table();
-    if (argc < 2) {
+    // my_db [--compress] <file>，--compress只对新建的文件生效
+    bool compress = argc >= 2 && strcmp(argv[1], "--compress") == 0;
+    if (argc < (compress ? 3 : 2)) {
         printf("Must supply a database filename.\n");
         exit(EXIT_FAILURE);
     }
 
-    const char *file_name = argv[1];
-    Table *table = db_open(file_name);
+    const char *file_name = argv[compress ? 2 : 1];
+    Database *db = db_open(file_name, compress);
 
     InputBuffer *input_buffer = new_input_buffer();
     while (true) {
         print_prompt();
         read_input(input_buffer);
         if (input_buffer->buffer[0] == '.') {
-            switch (do_meta_command(input_buffer, table)) {
+            switch (do_meta_command(input_buffer, db)) {
                 case META_COMMAND_SUCCESS:
                     continue;
                 case META_COMMAND_UNRECOGNIZED_COMMAND:
@@ -488,7 +1847,9 @@ int main(int argc, char const *argv[]) {
             }
         }
         Statement statement;
-        switch (prepare_statement(input_buffer, &statement)) {
+        Row row_insert;
+        statement.row_insert = &row_insert;
+        switch (prepare_statement(input_buffer, db, &statement)) {
             case PREPARE_SUCCESS:
                 break;
             case PREPARE_SYNTAX_ERROR:
@@ -500,14 +1861,23 @@ int main(int argc, char const *argv[]) {
             case (PREPARE_NEGATIVE_ID):
                 printf("ID must be positive.\n");
                 continue;
+            case (PREPARE_TABLE_NOT_FOUND):
+                printf("Table not found.\n");
+                continue;
             case PREPARE_UNRECOGNIZED_STATEMENT:
                 printf("Unrecognized statement '%s'.\n", input_buffer->buffer);
                 continue;
         }
-        switch (execute_statement(&statement, table)) {
+        switch (execute_statement(&statement, db)) {
             case (EXECUTE_SUCCESS):
                 printf("Executed.\n");
                 break;
+            case (EXECUTE_DUPLICATE_KEY):
+                printf("Error: Duplicate key.\n");
+                break;
+            case (EXECUTE_TABLE_EXISTS):
+                printf("Error: Table already exists.\n");
+                break;
             case (EXECUTE_TABLE_FULL):
                 printf("Error: Table full.\n");
                 break;
@@ -3,15 +3,48 @@
 //
 
 #include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #ifndef MY_DB_MY_DB_H
 #define MY_DB_MY_DB_H
 
 #endif //MY_DB_MY_DB_H
 
+// 默认表users的列定义：新建数据库时自动创建 users (id int, username text(32), email text(255))
+#define DEFAULT_TABLE_NAME "users"
 #define COLUMN_USERNAME_SIZE 32
 #define COLUMN_EMAIL_SIZE 255
 
+// 表名、列名的最大长度（不含'\0'）
+#define TABLE_NAME_SIZE 31
+#define COLUMN_NAME_SIZE 31
+// 每张表最多的列数
+#define TABLE_MAX_COLUMNS 8
+// 一行序列化后最多占用的字节数，保证一个leaf node至少能放下几行
+#define ROW_MAX_SIZE 1024
+// .vacuum重建时使用的临时文件后缀
+#define VACUUM_FILE_SUFFIX "-vacuum"
+// .backup写入时使用的临时文件后缀
+#define BACKUP_FILE_SUFFIX "-backup"
+// .backup每一步最多复制的页数
+#define BACKUP_STEP_PAGES 16
+// 压缩格式文件开头的magic，用来区分压缩格式和普通格式
+#define PAGER_MAGIC "my_db.z"
+// catalog root末尾的magic和文件格式版本号，用来拒绝旧格式或者不是数据库的文件
+#define DATABASE_MAGIC "my_db"
+#define DATABASE_FORMAT_VERSION 1
+
+// 页压缩使用的LZ编码：控制字节最高位为0，表示后面跟(控制字节 + 1)个原样字节；
+// 最高位为1，表示一个match，长度为(控制字节 & 0x7f) + LZ_MIN_MATCH，后面跟2字节的回溯距离
+#define LZ_MIN_MATCH 3
+#define LZ_MAX_MATCH (0x7f + LZ_MIN_MATCH)
+#define LZ_MAX_LITERALS 0x80
+#define LZ_MAX_OFFSET 0xffff
+#define LZ_HASH_BITS 12
+
 typedef struct {
     char *buffer;
     size_t buffer_length;
@@ -28,52 +61,66 @@ typedef enum {
     PREPARE_SYNTAX_ERROR,
     PREPARE_NEGATIVE_ID,
     PREPARE_STRING_TOO_LONG,
+    PREPARE_TABLE_NOT_FOUND,
     PREPARE_UNRECOGNIZED_STATEMENT
 } PrepareResult;
 
 typedef enum {
     STATEMENT_INSERT,
-    STATEMENT_SELECT
+    // insert or replace：key已存在时原地覆盖
+    STATEMENT_REPLACE,
+    STATEMENT_SELECT,
+    STATEMENT_CREATE_TABLE
 } StatementType;
 
+typedef enum {
+    COLUMN_INT,
+    COLUMN_TEXT
+} ColumnType;
+
+// 表的存储结构，create table时选择：B-tree按key有序；hash只支持按key精确查找，但只需读一个bucket
+typedef enum {
+    ACCESS_METHOD_BTREE,
+    ACCESS_METHOD_HASH
+} AccessMethod;
+
 typedef struct {
-    uint32_t id;
-    // 注意+1
-    //  C strings are supposed to end with a null character, which we should allocate space for.
-    // char username[COLUMN_USERNAME_SIZE];
-    // char email[COLUMN_EMAIL_SIZE];
-    char username[COLUMN_USERNAME_SIZE + 1];
-    char email[COLUMN_EMAIL_SIZE + 1];
-} Row;
+    char name[COLUMN_NAME_SIZE + 1];
+    ColumnType type;
+    // int列为4；text列为最大字符数（不含'\0'）
+    uint32_t size;
+    // 以下两个字段由schema_compute_layout在open/create时计算，不落盘
+    // 该列在行内的偏移量
+    uint32_t offset;
+    // 该列在行内占用的字节数，text列注意+1
+    uint32_t width;
+} Column;
 
 typedef struct {
-    StatementType type;
-    Row *row_insert;
-} Statement;
+    uint32_t num_columns;
+    // 第一列是主键，必须是int
+    Column columns[TABLE_MAX_COLUMNS];
+    // 每行占用的字节数
+    uint32_t row_size;
+} Schema;
+
+typedef struct {
+    // 主键，即第一列的值
+    uint32_t id;
+    // 按schema计算好的偏移量编码的一行数据
+    uint8_t data[ROW_MAX_SIZE];
+} Row;
 
 typedef enum {
     EXECUTE_SUCCESS,
+    EXECUTE_DUPLICATE_KEY,
+    EXECUTE_TABLE_EXISTS,
     EXECUTE_TABLE_FULL
 } ExecuteResult;
 
 // 定义获取struct属性占有的存储大小 sizeof操作符以字节形式给出了其操作数的存储大小
 #define size_of_attribute(Struct, Attribute) sizeof(((Struct *)0)->Attribute)
 
-// ID占用的字节数
-const uint32_t ID_SIZE = size_of_attribute(Row, id);
-// username占用的字节数
-const uint32_t USERNAME_SIZE = size_of_attribute(Row, username);
-// email占用的字节数
-const uint32_t EMAIL_SIZE = size_of_attribute(Row, email);
-
-// ID的偏移量
-const uint32_t ID_OFFSET = 0;
-// username的偏移量=ID的偏移量+id占有的字节数
-const uint32_t USERNAME_OFFSET = ID_OFFSET + ID_SIZE;
-// email的偏移量=username的偏移量+username占用的字节数
-const uint32_t EMAIL_OFFSET = USERNAME_OFFSET + USERNAME_SIZE;
-// 每行占用的字节数
-const uint32_t ROW_SIZE = ID_SIZE + USERNAME_SIZE + EMAIL_SIZE;
 //  每页的字节数
 const uint32_t PAGE_SIZE = 4096;
 
@@ -89,6 +136,17 @@ typedef struct {
     // 页数
     uint32_t num_pages;
     void *pages[TABLE_MAX_PAGES];
+    // 压缩格式：页在flush时压缩，在get_page cache miss时解压，cache里始终是未压缩的页
+    bool compressed;
+    // 压缩格式下每个逻辑页在文件中的位置、压缩后的长度、占用的空间
+    uint32_t page_offsets[TABLE_MAX_PAGES];
+    uint32_t page_lengths[TABLE_MAX_PAGES];
+    uint32_t page_capacities[TABLE_MAX_PAGES];
+    // 页被修改过、还没写回文件
+    bool dirty[TABLE_MAX_PAGES];
+    // 每修改一次页递增，backup用来判断复制之后页有没有再被修改
+    uint32_t change_counter;
+    uint32_t page_changes[TABLE_MAX_PAGES];
 } Pager;
 
 typedef struct {
@@ -96,19 +154,79 @@ typedef struct {
 //    void *pages[TABLE_MAX_PAGES];
     Pager *pager;
     uint32_t root_page_num;
+    // catalog中的key
+    uint32_t table_id;
+    char name[TABLE_NAME_SIZE + 1];
+    Schema schema;
+    // hash表的root是hash directory
+    AccessMethod access_method;
 } Table;
 
+typedef struct {
+    // 所有表共用一个Pager，即共用一个文件和一份page cache
+    Pager *pager;
+    // .vacuum替换文件时需要
+    char *file_name;
+    // 每次.vacuum换文件时递增，backup用来判断是否需要从头开始
+    uint32_t generation;
+    // catalog本身也是一棵B-tree，root固定在page 0，每个cell记录一张表的root和列定义
+    Table *catalog;
+    uint32_t num_tables;
+    // DATABASE_MAX_TABLES个元素
+    Table **tables;
+} Database;
+
+typedef enum {
+    BACKUP_DONE,
+    // 还有页没复制或者复制后又被修改，需要继续step
+    BACKUP_MORE,
+    BACKUP_ERROR
+} BackupResult;
+
+typedef struct {
+    Database *db;
+    // 开始复制时的Pager
+    Pager *source;
+    // 开始复制时db的generation，.vacuum之后需要从头开始
+    // 不能比较Pager指针：旧Pager释放后新Pager可能分配到同一个地址
+    uint32_t generation;
+    // 备份文件的Pager，格式和source一致
+    Pager *pager;
+    char *file_name;
+    char *backup_file_name;
+    // 每页是否已复制，以及复制时该页的page_changes
+    bool copied[TABLE_MAX_PAGES];
+    uint32_t copied_changes[TABLE_MAX_PAGES];
+} Backup;
+
+typedef struct {
+    StatementType type;
+    Table *table;
+    Row *row_insert;
+    // select ... where <key> = <n> 使用
+    bool has_key;
+    uint32_t key;
+    // create table使用
+    char table_name[TABLE_NAME_SIZE + 1];
+    Schema schema;
+    AccessMethod access_method;
+} Statement;
+
 typedef struct {
     Table *table;
 //    uint32_t row_num;
     uint32_t page_num;
     uint32_t cell_num;
+    // hash表扫描时当前bucket在directory中的下标
+    uint32_t directory_index;
     bool end_of_table;
 } Cursor;
 
 typedef enum {
     NODE_INTERNAL,
-    NODE_LEAF
+    NODE_LEAF,
+    NODE_HASH_DIRECTORY,
+    NODE_HASH_BUCKET
 } NodeType;
 
 /**
@@ -124,55 +242,188 @@ const uint8_t COMMON_NODE_HEADER_SIZE = NODE_TYPE_SIZE + IS_ROOT_SIZE + PARENT_P
 
 /**
  * Leaf Node Header Layout
+ * 不同表的行大小不同，cell大小记录在leaf node header中
  */
 const uint32_t LEAF_NODE_NUM_CELLS_SIZE = sizeof(uint32_t);
 const uint32_t LEAF_NODE_NUM_CELLS_OFFSET = COMMON_NODE_HEADER_SIZE;
-const uint32_t LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + LEAF_NODE_NUM_CELLS_SIZE;
+const uint32_t LEAF_NODE_CELL_SIZE_SIZE = sizeof(uint32_t);
+const uint32_t LEAF_NODE_CELL_SIZE_OFFSET = LEAF_NODE_NUM_CELLS_OFFSET + LEAF_NODE_NUM_CELLS_SIZE;
+const uint32_t LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + LEAF_NODE_NUM_CELLS_SIZE + LEAF_NODE_CELL_SIZE_SIZE;
 
 /**
  * Leaf Node Body Layout
  */
 const uint32_t LEAF_NODE_KEY_SIZE = sizeof(uint32_t);
 const uint32_t LEAF_NODE_KEY_OFFSET = 0;
-const uint32_t LEAF_NODE_VALUE_SIZE = ROW_SIZE;
+//const uint32_t LEAF_NODE_VALUE_SIZE = ROW_SIZE;
 const uint32_t LEAF_NODE_VALUE_OFFSET = LEAF_NODE_KEY_OFFSET + LEAF_NODE_KEY_SIZE;
-const uint32_t LEAF_NODE_CELL_SIZE = LEAF_NODE_KEY_SIZE + LEAF_NODE_VALUE_SIZE;
+//const uint32_t LEAF_NODE_CELL_SIZE = LEAF_NODE_KEY_SIZE + LEAF_NODE_VALUE_SIZE;
 const uint32_t LEAF_NODE_SPACE_FOR_CELLS = PAGE_SIZE - LEAF_NODE_HEADER_SIZE;
-const uint32_t LEAF_NODE_MAX_CELLS = LEAF_NODE_SPACE_FOR_CELLS / LEAF_NODE_CELL_SIZE;
+//const uint32_t LEAF_NODE_MAX_CELLS = LEAF_NODE_SPACE_FOR_CELLS / LEAF_NODE_CELL_SIZE;
+
+/**
+ * Hash Directory Layout
+ * extendible hashing：directory有2^global_depth项，每项是一个bucket的页号，按hash的低global_depth位定位
+ */
+const uint32_t HASH_DIRECTORY_GLOBAL_DEPTH_SIZE = sizeof(uint32_t);
+const uint32_t HASH_DIRECTORY_GLOBAL_DEPTH_OFFSET = COMMON_NODE_HEADER_SIZE;
+const uint32_t HASH_DIRECTORY_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + HASH_DIRECTORY_GLOBAL_DEPTH_SIZE;
+const uint32_t HASH_DIRECTORY_ENTRY_SIZE = sizeof(uint32_t);
+// directory只占一页，2^9项是一页能放下的最大的2的幂
+const uint32_t HASH_DIRECTORY_MAX_GLOBAL_DEPTH = 9;
+
+/**
+ * Hash Bucket Layout
+ * bucket和leaf node的布局相同（cell按key有序，可以直接用leaf_node_find），
+ * bucket没有parent，local depth存在parent pointer的位置
+ */
+const uint32_t HASH_BUCKET_LOCAL_DEPTH_SIZE = PARENT_POINTER_SIZE;
+const uint32_t HASH_BUCKET_LOCAL_DEPTH_OFFSET = PARENT_POINTER_OFFSET;
+
+/**
+ * Catalog Record Layout
+ * catalog表的value：table_id | root_page_num | name | num_columns | columns[TABLE_MAX_COLUMNS] | access_method
+ * 每列：name | type | size，offset和width在open时由schema重新计算
+ */
+const uint32_t CATALOG_TABLE_ID_SIZE = sizeof(uint32_t);
+const uint32_t CATALOG_TABLE_ID_OFFSET = 0;
+const uint32_t CATALOG_ROOT_PAGE_NUM_SIZE = sizeof(uint32_t);
+const uint32_t CATALOG_ROOT_PAGE_NUM_OFFSET = CATALOG_TABLE_ID_OFFSET + CATALOG_TABLE_ID_SIZE;
+const uint32_t CATALOG_NAME_SIZE = TABLE_NAME_SIZE + 1;
+const uint32_t CATALOG_NAME_OFFSET = CATALOG_ROOT_PAGE_NUM_OFFSET + CATALOG_ROOT_PAGE_NUM_SIZE;
+const uint32_t CATALOG_NUM_COLUMNS_SIZE = sizeof(uint32_t);
+const uint32_t CATALOG_NUM_COLUMNS_OFFSET = CATALOG_NAME_OFFSET + CATALOG_NAME_SIZE;
+const uint32_t CATALOG_COLUMNS_OFFSET = CATALOG_NUM_COLUMNS_OFFSET + CATALOG_NUM_COLUMNS_SIZE;
+const uint32_t CATALOG_COLUMN_NAME_SIZE = COLUMN_NAME_SIZE + 1;
+const uint32_t CATALOG_COLUMN_NAME_OFFSET = 0;
+const uint32_t CATALOG_COLUMN_TYPE_SIZE = sizeof(uint32_t);
+const uint32_t CATALOG_COLUMN_TYPE_OFFSET = CATALOG_COLUMN_NAME_OFFSET + CATALOG_COLUMN_NAME_SIZE;
+const uint32_t CATALOG_COLUMN_SIZE_SIZE = sizeof(uint32_t);
+const uint32_t CATALOG_COLUMN_SIZE_OFFSET = CATALOG_COLUMN_TYPE_OFFSET + CATALOG_COLUMN_TYPE_SIZE;
+const uint32_t CATALOG_COLUMN_RECORD_SIZE = CATALOG_COLUMN_NAME_SIZE + CATALOG_COLUMN_TYPE_SIZE + CATALOG_COLUMN_SIZE_SIZE;
+const uint32_t CATALOG_ACCESS_METHOD_SIZE = sizeof(uint32_t);
+const uint32_t CATALOG_ACCESS_METHOD_OFFSET = CATALOG_COLUMNS_OFFSET + CATALOG_COLUMN_RECORD_SIZE * TABLE_MAX_COLUMNS;
+const uint32_t CATALOG_RECORD_SIZE = CATALOG_ACCESS_METHOD_OFFSET + CATALOG_ACCESS_METHOD_SIZE;
+const uint32_t CATALOG_ROOT_PAGE_NUM = 0;
+
+/**
+ * Database Header Layout
+ * 存在catalog root（page 0）的最后：magic | format version，cell从前往后放，不会用到这部分空间
+ */
+const uint32_t DATABASE_MAGIC_SIZE = sizeof(DATABASE_MAGIC);
+const uint32_t DATABASE_VERSION_SIZE = sizeof(uint32_t);
+const uint32_t DATABASE_HEADER_SIZE = DATABASE_MAGIC_SIZE + DATABASE_VERSION_SIZE;
+const uint32_t DATABASE_MAGIC_OFFSET = PAGE_SIZE - DATABASE_HEADER_SIZE;
+const uint32_t DATABASE_VERSION_OFFSET = DATABASE_MAGIC_OFFSET + DATABASE_MAGIC_SIZE;
+// 一个数据库最多的表数，即catalog leaf node除去database header后能放下的cell数
+const uint32_t DATABASE_MAX_TABLES = (LEAF_NODE_SPACE_FOR_CELLS - DATABASE_HEADER_SIZE) / (LEAF_NODE_KEY_SIZE + CATALOG_RECORD_SIZE);
+
+/**
+ * Compressed File Header Layout
+ * 压缩格式的文件开头是一个PAGE_SIZE大小的header：magic | num_pages | page map[TABLE_MAX_PAGES]
+ * page map每项：offset | length | capacity；length为0表示该页没写过，length为PAGE_SIZE表示该页未压缩
+ */
+const uint32_t PAGER_MAGIC_SIZE = sizeof(PAGER_MAGIC);
+const uint32_t PAGER_MAGIC_OFFSET = 0;
+const uint32_t PAGER_NUM_PAGES_SIZE = sizeof(uint32_t);
+const uint32_t PAGER_NUM_PAGES_OFFSET = PAGER_MAGIC_OFFSET + PAGER_MAGIC_SIZE;
+const uint32_t PAGER_PAGE_MAP_OFFSET = PAGER_NUM_PAGES_OFFSET + PAGER_NUM_PAGES_SIZE;
+const uint32_t PAGE_MAP_ENTRY_SIZE = 3 * sizeof(uint32_t);
+const uint32_t PAGER_HEADER_SIZE = PAGE_SIZE;
+// 压缩页在文件中占用的空间按此对齐，页内容略有增长时还能原地覆盖
+const uint32_t PAGE_SLOT_ALIGNMENT = 128;
 
 InputBuffer *new_input_buffer();
 
 void print_prompt();
 
-MetaCommandResult do_meta_command(InputBuffer *input_buffer, Table *table);
+MetaCommandResult do_meta_command(InputBuffer *input_buffer, Database *db);
 
 void read_input(InputBuffer *input_buffer);
 
 void close_input_buffer(InputBuffer *input_buffer);
 
-PrepareResult prepare_statement(InputBuffer *input_buffer, Statement *statement);
+PrepareResult prepare_statement(InputBuffer *input_buffer, Database *db, Statement *statement);
+
+PrepareResult prepare_insert(InputBuffer *input_buffer, Database *db, Statement *statement);
+
+PrepareResult prepare_select(InputBuffer *input_buffer, Database *db, Statement *statement);
 
-PrepareResult prepare_insert(InputBuffer *input_buffer, Statement *statement);
+PrepareResult prepare_create_table(InputBuffer *input_buffer, Statement *statement);
 
-ExecuteResult execute_statement(Statement *statement, Table *table);
+ExecuteResult execute_statement(Statement *statement, Database *db);
 
-ExecuteResult execute_insert(Statement *statement, Table *table);
+ExecuteResult execute_insert(Statement *statement, Table *table, bool replace);
 
 void leaf_node_insert(Cursor* cursor, uint32_t key, Row* value);
 
 ExecuteResult execute_select(Statement *statement, Table *table);
 
-void serialize_row(Row *source, void *destination);
+ExecuteResult execute_create_table(Statement *statement, Database *db);
 
-void deserialize_row(void *source, Row *destination);
+bool schema_compute_layout(Schema *schema);
 
-Table *db_open(const char *file_name);
+PrepareResult row_set_value(Schema *schema, Row *row, uint32_t column_num, const char *value);
 
-Pager *pager_open(const char *file_name);
+void serialize_row(Schema *schema, Row *source, void *destination);
+
+void deserialize_row(Schema *schema, void *source, Row *destination);
+
+void serialize_catalog_record(Table *source, void *destination);
+
+bool deserialize_catalog_record(void *source, Table *destination);
+
+Database *db_open(const char *file_name, bool compress);
+
+Table *db_find_table(Database *db, const char *name);
+
+bool db_vacuum(Database *db);
+
+Backup *backup_init(Database *db, const char *file_name);
+
+bool file_sync_directory(const char *file_name);
+
+bool file_is_same(const char *file_name, struct stat *file_stat);
+
+bool backup_restart(Backup *backup);
+
+void backup_abort(Backup *backup);
+
+bool backup_page_pending(Backup *backup, uint32_t page_num);
+
+BackupResult backup_step(Backup *backup, uint32_t num_pages);
+
+bool backup_page_on_disk(Pager *pager, uint32_t page_num);
+
+bool backup_copy_pages(Backup *backup, uint32_t page_num, uint32_t count);
+
+bool file_copy_range(int source_fd, off_t source_offset, int destination_fd, off_t destination_offset, size_t length);
+
+BackupResult backup_finish(Backup *backup);
+
+Pager *pager_open(const char *file_name, bool compress);
+
+void pager_read_header(Pager *pager);
+
+void pager_write_header(Pager *pager);
+
+uint32_t get_unused_page_num(Pager *pager);
 
 Cursor *table_start(Table *table);
 
-Cursor *table_end(Table *table);
+//Cursor *table_end(Table *table);
+
+Cursor *table_find(Table *table, uint32_t key);
+
+Cursor *leaf_node_find(Table *table, uint32_t page_num, uint32_t key);
+
+Cursor *hash_find(Table *table, uint32_t key);
+
+uint32_t hash_key(uint32_t key);
+
+bool hash_split_bucket(Table *table, uint32_t page_num);
+
+void hash_cursor_next_bucket(Cursor *cursor);
 
 void *cursor_value(Cursor *cursor);
 
@@ -180,21 +431,57 @@ void cursor_advance(Cursor *cursor);
 
 void *get_page(Pager *pager, uint32_t page_num);
 
-void *db_close(Table *table);
+void *db_close(Database *db);
+
+void pager_close(Pager *pager, bool flush);
+
+void pager_flush_all(Pager *pager);
 
 //void pager_flush(Pager *pager, uint32_t page_num, uint32_t size);
 void pager_flush(Pager *pager, uint32_t page_num);
 
+void pager_mark_dirty(Pager *pager, uint32_t page_num);
+
+uint32_t page_compress(const uint8_t *source, uint32_t source_length, uint8_t *destination, uint32_t destination_capacity);
+
+bool lz_emit_literals(const uint8_t *source, uint32_t start, uint32_t end, uint8_t *destination, uint32_t *out, uint32_t destination_capacity);
+
+bool page_decompress(const uint8_t *source, uint32_t source_length, uint8_t *destination, uint32_t destination_length);
+
 uint32_t *leaf_node_num_cells(void *node);
 
+uint32_t *leaf_node_cell_size(void *node);
+
+uint32_t leaf_node_max_cells(void *node);
+
 void *leaf_node_cell(void *node, uint32_t cell_num);
 
 uint32_t *leaf_node_key(void *node, uint32_t cell_num);
 
 uint32_t *leaf_node_value(void *node, uint32_t cell_num);
 
-void initialize_leaf_node(void *node);
+NodeType get_node_type(void *node);
+
+void set_node_type(void *node, NodeType type);
+
+void initialize_leaf_node(void *node, uint32_t cell_size);
+
+void initialize_catalog_node(void *node);
+
+bool catalog_node_valid(void *node);
+
+uint32_t *hash_directory_global_depth(void *node);
+
+uint32_t *hash_directory_entry(void *node, uint32_t index);
+
+uint32_t *hash_bucket_local_depth(void *node);
+
+void initialize_hash_directory(void *node);
+
+void initialize_hash_bucket(void *node, uint32_t cell_size, uint32_t local_depth);
+
+void vacuum_copy_cells(void *source, void *destination);
 
 //void *row_slot(Table *table, uint32_t row_num);
 
-void print_row(Row *row);
\ No newline at end of file
+void print_row(Schema *schema, Row *row);